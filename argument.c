@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -26,6 +27,7 @@ static const char *token_name[] = { "BAD", "END", "ENTRY", "DELIM", "NUMBER" };
 
 static const struct option long_options[] = {
     {"output_file", required_argument, NULL, 'o'},
+    {"format", required_argument, NULL, 'F'},
     {"size", required_argument, NULL, 's'},
     {"anchors", required_argument, NULL, 'a'},
     {"anchors_from", required_argument, NULL, 'A'},
@@ -34,6 +36,20 @@ static const struct option long_options[] = {
     {"frames", required_argument, NULL, 'f'},
     {"keep", no_argument, NULL, 'k'},
     {"seed", required_argument, NULL, 'x'},
+    {"cell_stats", required_argument, NULL, 'S'},
+    {"relax", required_argument, NULL, 'r'},
+    {"relax_threshold", required_argument, NULL, 'R'},
+    {"metric", required_argument, NULL, 'm'},
+    {"antialias", required_argument, NULL, 'n'},
+    {"aa_pattern", required_argument, NULL, 'P'},
+    {"threads", required_argument, NULL, 't'},
+    {"pin", no_argument, NULL, 'p'},
+    {"hugepages", no_argument, NULL, 'H'},
+    {"cache", required_argument, NULL, 'K'},
+    {"cache_limit", required_argument, NULL, 'L'},
+    {"workers", required_argument, NULL, 'w'},
+    {"worker", required_argument, NULL, 'W'},
+    {"serve", required_argument, NULL, 'l'},
     {"verbose", optional_argument, NULL, 'v'},
     {"help", optional_argument, NULL, 'h'},
     {0, 0, 0, 0},
@@ -41,6 +57,17 @@ static const struct option long_options[] = {
 
 static const size_t long_options_size = sizeof(long_options) / sizeof(long_options[0]);
 
+static const char *metric_names[] = {
+    [METRIC_EUCLIDEAN] = "euclidean",
+    [METRIC_MANHATTAN] = "manhattan",
+    [METRIC_CHEBYSHEV] = "chebyshev",
+    [METRIC_ADDITIVE] = "additive",
+    [METRIC_MULTIPLICATIVE] = "multiplicative",
+    [METRIC_POWER] = "power",
+};
+
+static const size_t metric_names_size = sizeof(metric_names) / sizeof(metric_names[0]);
+
 static Token parseToken(const char *, const char **, long *);
 static long *parseEntries(const char *, size_t, size_t *);
 static char *mmapFile(const char *, size_t *);
@@ -52,18 +79,15 @@ Token parseToken(const char *fmt, const char **next, long *number) {
     char digit_buff[16];
     size_t idx = 0;
 
-    do {
-        if((c = *fmt) == '\0') {
-            if(next) *next = fmt;
-            return END;
-        }
-    } while(isspace(*fmt++));
+    /* Newlines separate entries so they are not skipped as whitespace */
+    while((c = *fmt++) != '\n' && isspace(c));
 
-    switch(c) {
-        case 0:
-            if(next) *next = fmt;
-            return END;
+    if(c == '\0') {
+        if(next) *next = fmt - 1;
+        return END;
+    }
 
+    switch(c) {
         case ';':
         case '\n':
             if(next) *next = fmt;
@@ -124,7 +148,12 @@ long *parseEntries(const char *fmt, size_t members_count, size_t *written) {
             case END:
                 parsed = true;
             case ENTRY:
-                if(num_entries == 0 && numbers == 0) return NULL;
+                /* Empty entries, such as blank lines, are skipped */
+                if(num_entries == 0 && numbers == 0) {
+                    if(parsed) return NULL;
+                    break;
+                }
+
                 if(num_entries == 0 && numbers != 1 && numbers != members_count) return NULL;
                 if(num_entries > 0 && numbers != 0 && numbers != members_count) return NULL;
 
@@ -178,7 +207,7 @@ long *parseEntries(const char *fmt, size_t members_count, size_t *written) {
             case END:
                 parsed = true;
             case ENTRY:
-                num_entries++;
+                if(numbers > 0) num_entries++;
                 numbers = 0;
                 break;
 
@@ -211,9 +240,19 @@ static point parseSize(const char *fmt) {
     return ret;
 }
 
+/*
+    Anchors are either `x, y` pairs or `x, y, weight` triples, the weight is
+    only used by the weighted metrics and defaults to 1.
+*/
 static anchor *parseAnchors(const char *fmt, long *size) {
+    size_t members = 2;
     size_t memb_size = 0;
-    long *memb = parseEntries(fmt, 2, &memb_size);
+    long *memb = parseEntries(fmt, members, &memb_size);
+
+    if(!memb) {
+        members = 3;
+        memb = parseEntries(fmt, members, &memb_size);
+    }
 
     if(!size || !memb || memb_size == 0)
         return NULL;
@@ -221,13 +260,15 @@ static anchor *parseAnchors(const char *fmt, long *size) {
     anchor *anc = NULL;
 
     if(memb_size > 1) {
-        size_t count = memb_size / 2;
-        anc = calloc(memb_size * memb_size / 2, sizeof(anchor));
-        for(size_t idx = 0, ent = 0; idx < memb_size; idx += 2, ent++) {
+        size_t count = memb_size / members;
+        anc = calloc(count, sizeof(anchor));
+        for(size_t idx = 0, ent = 0; idx < memb_size; idx += members, ent++) {
             anc[ent].pos.x = memb[idx];
             anc[ent].pos.y = memb[idx + 1];
+            anc[ent].weight = members == 3 ? memb[idx + 2] : 1;
         }
 
+        free(memb);
         *size = count;
     } else {
         anc = NULL;
@@ -301,13 +342,24 @@ Params parseArguments(int argc, char **argv) {
     int opt_idx = -1;
 
 
-    while((opt = getopt_long(argc, argv, "o:s:a:A:c:C:f:kx:v::h", long_options, &opt_idx)) != -1) {
+    while((opt = getopt_long(argc, argv, "o:F:s:a:A:c:C:f:kx:S:r:R:m:n:P:t:pHK:L:w:W:l:v::h", long_options, &opt_idx)) != -1) {
         switch(opt) {
             case 'o': {
                 params.filename = optarg;
                 break;
             }
 
+            case 'F': {
+                output_format f = formatFromName(optarg);
+
+                if(f == FORMAT_NONE) {
+                    errx(1, "Invalid format option %s", optarg);
+                }
+
+                params.format = f;
+                break;
+            }
+
             case 's': {
                 point p = parseSize(optarg);
 
@@ -437,7 +489,135 @@ Params parseArguments(int argc, char **argv) {
                 break;
             }
 
+            case 'S': {
+                params.cell_stats_file = optarg;
+                break;
+            }
+
+            case 'r': {
+                long relax = getNumber(optarg);
+
+                if(relax < 0) {
+                    errx(1, "Invalid relax option: %s", optarg);
+                }
+
+                params.relax = relax;
+                break;
+            }
+
+            case 'R': {
+                long threshold = getNumber(optarg);
+
+                if(threshold < 0) {
+                    errx(1, "Invalid relax threshold option: %s", optarg);
+                }
+
+                params.relax_threshold = threshold;
+                break;
+            }
+
+            case 'm': {
+                distance_metric m = 0;
+
+                while(m < metric_names_size && strcmp(optarg, metric_names[m]) != 0) m++;
+
+                if(m == metric_names_size) {
+                    errx(1, "Invalid metric option: %s", optarg);
+                }
+
+                params.render.metric = m;
+                break;
+            }
+
+            case 'n': {
+                long samples = getNumber(optarg);
+
+                if(samples <= 0 || samples > MAX_ANTIALIAS) {
+                    errx(1, "Invalid antialias option: %s", optarg);
+                }
+
+                params.render.antialias = samples;
+                break;
+            }
+
+            case 'P': {
+                if(strcmp(optarg, "grid") == 0) {
+                    params.render.pattern = PATTERN_GRID;
+                } else if(strcmp(optarg, "rooks") == 0) {
+                    params.render.pattern = PATTERN_ROOKS;
+                } else {
+                    errx(1, "Invalid antialias pattern option: %s", optarg);
+                }
+
+                break;
+            }
+
+            case 't': {
+                long threads = getNumber(optarg);
+
+                if(threads <= 0) {
+                    errx(1, "Invalid threads option: %s", optarg);
+                }
+
+                params.render.threads = threads;
+                break;
+            }
+
+            case 'p': {
+                params.render.pin = true;
+                break;
+            }
+
+            case 'H': {
+                params.hugepages = true;
+                break;
+            }
+
+            case 'K': {
+                params.cache_dir = optarg;
+                break;
+            }
+
+            case 'L': {
+                long limit = getNumber(optarg);
+
+                if(limit <= 0) {
+                    errx(1, "Invalid cache limit option: %s", optarg);
+                }
+
+                params.cache_limit = (size_t)limit << 20;
+                break;
+            }
+
+            case 'w': {
+                long workers = getNumber(optarg);
+
+                if(workers <= 0) {
+                    errx(1, "Invalid workers option: %s", optarg);
+                }
+
+                params.workers = workers;
+                break;
+            }
+
+            case 'W': {
+                const char **addrs = realloc(params.worker_addrs, (params.worker_addrs_size + 1) * sizeof(char*));
+                if(!addrs) {
+                    err(1, "Failed to allocate memory");
+                }
+
+                addrs[params.worker_addrs_size++] = optarg;
+                params.worker_addrs = addrs;
+                break;
+            }
+
+            case 'l': {
+                params.serve = optarg;
+                break;
+            }
+
             case 'v': {
+                params.render.verbose = true;
                 break;
             }
 
@@ -452,6 +632,9 @@ Params parseArguments(int argc, char **argv) {
         }
     }
 
+    /* A worker gets everything else from the coordinator */
+    if(params.serve) return params;
+
     if(params.seed == 0) {
         void* addr = malloc(0);
         params.seed = (long)*(long*)&addr;
@@ -463,6 +646,35 @@ Params parseArguments(int argc, char **argv) {
         errx(1, "No input file");
     }
 
+    if(params.format == FORMAT_NONE) {
+        params.format = params.frames > 1 ? FORMAT_GIF : formatFromFilename(params.filename);
+        if(params.format == FORMAT_NONE) params.format = FORMAT_PNG;
+    }
+
+    if(params.frames > 1 && params.format != FORMAT_GIF) {
+        errx(1, "Multiple frames can only be written to a GIF file");
+    }
+
+    if(params.frames > 1 && params.cell_stats_file) {
+        errx(1, "Cell statistics can not be collected for multiple frames");
+    }
+
+    if(isVectorFormat(params.format) && params.cell_stats_file) {
+        errx(1, "Cell statistics can only be collected for raster images");
+    }
+
+    if(params.cache_dir && (params.keep || params.cell_stats_file)) {
+        errx(1, "Cached output can not be combined with kept frames or cell statistics");
+    }
+
+    if((params.workers > 0 || params.worker_addrs_size > 0) && (params.frames > 1 || params.cell_stats_file || isVectorFormat(params.format))) {
+        errx(1, "Sharded rendering only supports single raster images without cell statistics");
+    }
+
+    if(isVectorFormat(params.format) && params.render.metric != METRIC_EUCLIDEAN) {
+        errx(1, "Vector output is only supported for the euclidean metric");
+    }
+
     if(!params.colors) {
         params.colors = calloc(params.colors_size, sizeof(color));
         if(!params.colors) {
@@ -482,6 +694,15 @@ Params parseArguments(int argc, char **argv) {
 
         for(size_t idx = 0; idx < params.anchors_size; idx++) {
             params.anchors[idx].pos = randomPoint(params.size);
+            params.anchors[idx].weight = 1;
+        }
+    }
+
+    if(params.render.metric == METRIC_MULTIPLICATIVE) {
+        for(size_t idx = 0; idx < params.anchors_size; idx++) {
+            if(params.anchors[idx].weight <= 0) {
+                errx(1, "Anchor weights must be positive for the multiplicative metric");
+            }
         }
     }
 
@@ -5,9 +5,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "./canvas.h"
+#include "./output.h"
 
 typedef struct Params {
     const char *filename;
+    output_format format;
     point size;
     anchor *anchors;
     size_t anchors_size;
@@ -16,10 +18,22 @@ typedef struct Params {
     int frames;
     bool keep;
     long seed;
+    const char *cell_stats_file;
+    long relax;
+    long relax_threshold;
+    bool hugepages;
+    const char *cache_dir;
+    size_t cache_limit;
+    long workers;
+    const char **worker_addrs;
+    size_t worker_addrs_size;
+    const char *serve;
+    render_options render;
 } Params;
 
 #define NEW_PARAMS() (Params){ \
     .filename = NULL, \
+    .format = FORMAT_NONE, \
     .size = {250, 250}, \
     .anchors = NULL, \
     .anchors_size = 10, \
@@ -27,7 +41,18 @@ typedef struct Params {
     .colors_size = 60, \
     .frames = 1, \
     .keep = false, \
-    .seed = 0 \
+    .seed = 0, \
+    .cell_stats_file = NULL, \
+    .relax = 0, \
+    .relax_threshold = 0, \
+    .hugepages = false, \
+    .cache_dir = NULL, \
+    .cache_limit = 256UL << 20, \
+    .workers = 0, \
+    .worker_addrs = NULL, \
+    .worker_addrs_size = 0, \
+    .serve = NULL, \
+    .render = NEW_RENDER_OPTIONS() \
 }
 
 Params parseArguments(int, char **);
@@ -0,0 +1,406 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "./cache.h"
+
+#define CACHE_MAGIC "VORONOI1"
+#define CACHE_MAGIC_SIZE 8
+#define ENTRY_SUFFIX ".entry"
+#define COPY_BUFFER_SIZE (1 << 20)
+
+/*
+    A cache directory holds one <hash>.entry file per output. Each starts
+    with the magic, the key size and the key itself, which is compared on
+    every lookup so a hash collision is only a miss. The rest of the file
+    is the output, byte for byte. Files are written under a temporary name
+    and renamed into place, the modification time of an entry is its last
+    use and the oldest entries are removed once the directory grows past
+    its limit.
+*/
+
+static bool growKey(cache_key *key, size_t size) {
+    if(key->failed) return false;
+    if(key->size + size <= key->capacity) return true;
+
+    size_t capacity = key->capacity ? key->capacity : 256;
+    while(capacity < key->size + size) capacity *= 2;
+
+    uint8_t *data = realloc(key->data, capacity);
+    if(!data) {
+        key->failed = true;
+        return false;
+    }
+
+    key->data = data;
+    key->capacity = capacity;
+    return true;
+}
+
+void keyNumber(cache_key *key, int64_t value) {
+    if(!growKey(key, 8)) return;
+
+    uint64_t bits = value;
+    for(int byte = 0; byte < 8; byte++) {
+        key->data[key->size++] = bits >> (8 * byte);
+    }
+}
+
+void keyBytes(cache_key *key, const void *bytes, size_t size) {
+    keyNumber(key, size);
+    if(!growKey(key, size)) return;
+
+    memcpy(key->data + key->size, bytes, size);
+    key->size += size;
+}
+
+void freeKey(cache_key *key) {
+    free(key->data);
+    *key = (cache_key){0};
+}
+
+/* FNV-1a */
+static uint64_t hashKey(const cache_key *key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(size_t idx = 0; idx < key->size; idx++) {
+        hash ^= key->data[idx];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void entryPath(char *path, const char *dir, const cache_key *key) {
+    snprintf(path, PATH_MAX, "%s/%016llx" ENTRY_SUFFIX, dir, (unsigned long long)hashKey(key));
+}
+
+static bool readAll(int fd, void *buf, size_t size) {
+    uint8_t *pos = buf;
+
+    while(size > 0) {
+        ssize_t got = read(fd, pos, size);
+        if(got <= 0) {
+            if(got < 0 && errno == EINTR) continue;
+            return false;
+        }
+
+        pos += got;
+        size -= got;
+    }
+
+    return true;
+}
+
+static bool writeAll(int fd, const void *buf, size_t size) {
+    const uint8_t *pos = buf;
+
+    while(size > 0) {
+        ssize_t put = write(fd, pos, size);
+        if(put < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+
+        pos += put;
+        size -= put;
+    }
+
+    return true;
+}
+
+/* Copies the rest of `in` to `out` */
+static bool copyData(int in, int out) {
+    uint8_t *buffer = malloc(COPY_BUFFER_SIZE);
+    if(!buffer) return false;
+
+    bool ok = true;
+
+    for(;;) {
+        ssize_t got = read(in, buffer, COPY_BUFFER_SIZE);
+        if(got < 0 && errno == EINTR) continue;
+
+        if(got <= 0) {
+            ok = got == 0;
+            break;
+        }
+
+        if(!writeAll(out, buffer, got)) {
+            ok = false;
+            break;
+        }
+    }
+
+    free(buffer);
+    return ok;
+}
+
+/* Opens a temporary file next to `path` for a later rename over it */
+static int openTemporary(const char *path, char *temp) {
+    if(snprintf(temp, PATH_MAX, "%s.tmp.XXXXXX", path) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = mkstemp(temp);
+    if(fd != -1) fchmod(fd, 0644);
+    return fd;
+}
+
+static bool commitTemporary(int fd, const char *temp, const char *path) {
+    bool ok = fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+
+    if(!ok) unlink(temp);
+    return ok;
+}
+
+/*
+    Adds the deltas to the counters kept in the cache directory and returns
+    the totals. The file is locked since any number of processes can share
+    one cache.
+*/
+static void updateCounters(const char *dir, const cache_counters *delta, cache_counters *total) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/counters", dir);
+
+    cache_counters counters = {0};
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if(fd == -1 || flock(fd, LOCK_EX) == -1) {
+        if(fd != -1) close(fd);
+        if(total) *total = *delta;
+        return;
+    }
+
+    FILE *fp = fdopen(fd, "r+");
+    if(!fp) {
+        close(fd);
+        if(total) *total = *delta;
+        return;
+    }
+
+    if(fscanf(fp, "hits %lu misses %lu evictions %lu", &counters.hits, &counters.misses, &counters.evictions) != 3) {
+        counters = (cache_counters){0};
+    }
+
+    counters.hits += delta->hits;
+    counters.misses += delta->misses;
+    counters.evictions += delta->evictions;
+
+    rewind(fp);
+    fprintf(fp, "hits %lu\nmisses %lu\nevictions %lu\n", counters.hits, counters.misses, counters.evictions);
+    fflush(fp);
+    if(ftruncate(fd, ftell(fp)) == -1) warn("Failed to truncate %s", path);
+
+    /* Closing the stream also drops the lock */
+    fclose(fp);
+    if(total) *total = counters;
+}
+
+/*
+    Copies the cached output for `key` to `filename`, returns false on a
+    miss. Errors reading the cache count as a miss so rendering can go on.
+*/
+bool cacheFetch(const char *dir, const cache_key *key, const char *filename, cache_counters *total) {
+    cache_counters delta = { .misses = 1 };
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    uint8_t magic[CACHE_MAGIC_SIZE];
+    uint8_t size[8];
+    uint8_t *stored = NULL;
+    bool hit = false;
+
+    if(mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        warn("Failed to create %s", dir);
+    }
+
+    if(key->failed) {
+        updateCounters(dir, &delta, total);
+        return false;
+    }
+
+    entryPath(path, dir, key);
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        updateCounters(dir, &delta, total);
+        return false;
+    }
+
+    if(!readAll(fd, magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_SIZE) != 0) goto done;
+    if(!readAll(fd, size, sizeof(size))) goto done;
+
+    uint64_t key_size = 0;
+    for(int byte = 0; byte < 8; byte++) key_size |= (uint64_t)size[byte] << (8 * byte);
+    if(key_size != key->size) goto done;
+
+    stored = malloc(key->size);
+    if(!stored || !readAll(fd, stored, key->size) || memcmp(stored, key->data, key->size) != 0) goto done;
+
+    int out = openTemporary(filename, temp);
+    if(out == -1) {
+        warn("Failed to open a temporary file for %s", filename);
+        goto done;
+    }
+
+    if(!copyData(fd, out)) {
+        warn("Failed to copy %s", path);
+        close(out);
+        unlink(temp);
+        goto done;
+    }
+
+    if(!commitTemporary(out, temp, filename)) {
+        warn("Failed to write %s", filename);
+        goto done;
+    }
+
+    /* Marks the entry as recently used */
+    utimensat(AT_FDCWD, path, NULL, 0);
+    hit = true;
+    delta = (cache_counters){ .hits = 1 };
+
+done:
+    free(stored);
+    close(fd);
+    updateCounters(dir, &delta, total);
+    return hit;
+}
+
+typedef struct cache_entry {
+    char name[NAME_MAX + 1];
+    struct timespec used;
+    off_t size;
+} cache_entry;
+
+static int compareEntries(const void *a, const void *b) {
+    const cache_entry *ea = a;
+    const cache_entry *eb = b;
+
+    if(ea->used.tv_sec != eb->used.tv_sec) return ea->used.tv_sec < eb->used.tv_sec ? -1 : 1;
+    if(ea->used.tv_nsec != eb->used.tv_nsec) return ea->used.tv_nsec < eb->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Removes the least recently used entries until the cache fits in `limit` bytes */
+static long evictEntries(const char *dir, size_t limit) {
+    DIR *dp = opendir(dir);
+    if(!dp) return 0;
+
+    cache_entry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    size_t total = 0;
+    struct dirent *ent;
+    long evicted = 0;
+
+    while((ent = readdir(dp))) {
+        size_t len = strlen(ent->d_name);
+        size_t suffix = sizeof(ENTRY_SUFFIX) - 1;
+        if(len <= suffix || strcmp(ent->d_name + len - suffix, ENTRY_SUFFIX) != 0) continue;
+
+        struct stat st;
+        if(fstatat(dirfd(dp), ent->d_name, &st, 0) == -1) continue;
+
+        if(count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            cache_entry *grown = realloc(entries, capacity * sizeof(cache_entry));
+            if(!grown) break;
+            entries = grown;
+        }
+
+        strcpy(entries[count].name, ent->d_name);
+        entries[count].used = st.st_mtim;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+
+    qsort(entries, count, sizeof(cache_entry), compareEntries);
+
+    for(size_t idx = 0; idx < count && total > limit; idx++) {
+        if(unlinkat(dirfd(dp), entries[idx].name, 0) == 0) evicted++;
+        total -= entries[idx].size;
+    }
+
+    closedir(dp);
+    free(entries);
+    return evicted;
+}
+
+/* Stores the output in `filename` under `key` and trims the cache to `limit` bytes */
+int cacheStore(const char *dir, const cache_key *key, const char *filename, size_t limit, cache_counters *total) {
+    cache_counters delta = {0};
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    uint8_t size[8];
+
+    if(key->failed) {
+        warnx("Failed to allocate the cache key");
+        return 0;
+    }
+
+    if(mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        warn("Failed to create %s", dir);
+        return 0;
+    }
+
+    int in = open(filename, O_RDONLY);
+    if(in == -1) {
+        warn("Failed to open %s", filename);
+        return 0;
+    }
+
+    struct stat st;
+    if(fstat(in, &st) == -1 || (size_t)st.st_size + key->size > limit) {
+        /* Would push every other entry out */
+        close(in);
+        updateCounters(dir, &delta, total);
+        return 1;
+    }
+
+    entryPath(path, dir, key);
+
+    int fd = openTemporary(path, temp);
+    if(fd == -1) {
+        warn("Failed to open a temporary file for %s", path);
+        close(in);
+        return 0;
+    }
+
+    for(int byte = 0; byte < 8; byte++) size[byte] = (uint64_t)key->size >> (8 * byte);
+
+    bool ok = writeAll(fd, CACHE_MAGIC, CACHE_MAGIC_SIZE)
+        && writeAll(fd, size, sizeof(size))
+        && writeAll(fd, key->data, key->size)
+        && copyData(in, fd);
+
+    close(in);
+
+    if(!ok) {
+        warn("Failed to write %s", temp);
+        close(fd);
+        unlink(temp);
+        return 0;
+    }
+
+    if(!commitTemporary(fd, temp, path)) {
+        warn("Failed to write %s", path);
+        return 0;
+    }
+
+    delta.evictions = evictEntries(dir, limit);
+    updateCounters(dir, &delta, total);
+    return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef VORONOI_CACHE_H
+#define VORONOI_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+    Canonical bytes of everything that decides the rendered output, numbers
+    are stored as little endian 64 bit integers so the same parameters give
+    the same key on every machine.
+*/
+typedef struct cache_key {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} cache_key;
+
+typedef struct cache_counters {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} cache_counters;
+
+void keyNumber(cache_key *, int64_t);
+void keyBytes(cache_key *, const void *, size_t);
+void freeKey(cache_key *);
+
+bool cacheFetch(const char *, const cache_key *, const char *, cache_counters *);
+int cacheStore(const char *, const cache_key *, const char *, size_t, cache_counters *);
+
+#endif
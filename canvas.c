@@ -1,19 +1,26 @@
 #define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <math.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <err.h>
 
 #include "./canvas.h"
-#include <png.h>
-#include <wand/MagickWand.h>
+#include "./pool.h"
+
+#define HUGE_PAGE_SIZE (2UL << 20)
 
 point randomPoint(point range) {
     return (point){
@@ -30,228 +37,611 @@ color randomColor(void) {
     };
 }
 
-color determinePixelColor(const anchor *anchors, size_t size, point target) {
-    long min = LONG_MAX;
-    color c;
+static void storeColor(const framebuffer *fb, point target, color c) {
+    uint8_t *row = fb->data + (target.y - fb->first_row) * fb->stride + target.x * 3;
 
-    for(size_t idx = 0; idx < size; idx++) {
-        point d = {
-            anchors[idx].pos.x - target.x,
-            anchors[idx].pos.y - target.y,
-        };
-
-        long current = d.x * d.x + d.y * d.y;
+    if(fb->format == PIXEL_BGR) {
+        row[0] = c.blue;
+        row[1] = c.green;
+        row[2] = c.red;
+    } else {
+        row[0] = c.red;
+        row[1] = c.green;
+        row[2] = c.blue;
+    }
+}
 
-        if(min > current) {
-            min = current;
-            c = anchors[idx].col;
-        }
+static void storePixel(const framebuffer *fb, point target, const anchor *anchors, size_t nearest) {
+    uint8_t *row = fb->data + (target.y - fb->first_row) * fb->stride;
+    color c = anchors[nearest].col;
+
+    switch(fb->format) {
+        case PIXEL_RGB:
+            row += target.x * 3;
+            row[0] = c.red;
+            row[1] = c.green;
+            row[2] = c.blue;
+            break;
+
+        case PIXEL_BGR:
+            row += target.x * 3;
+            row[0] = c.blue;
+            row[1] = c.green;
+            row[2] = c.red;
+            break;
+
+        case PIXEL_INDEX:
+            ((uint32_t*)row)[target.x] = nearest;
+            break;
     }
+}
 
-    return c;
+size_t pixelSize(pixel_format format) {
+    return format == PIXEL_INDEX ? sizeof(uint32_t) : 3;
 }
 
-void *calculateChunk(void *arg) {
-    task_arg *targ = (task_arg*) arg;
+static double elapsed(const struct timespec *from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) + (now.tv_nsec - from->tv_nsec) / 1e9;
+}
 
-    point a = {
-        .x = targ->start % targ->size.x,
-        .y = targ->start / targ->size.x
-    };
+#define PAGE_SAMPLES 64
 
-    point b = {
-        .x = (targ->start + targ->run) % targ->size.x,
-        .y = (targ->start + targ->run) / targ->size.x
-    };
+/*
+    Asks the kernel which node holds the pages of the pixels from `start`
+    to `start + run`, sampling at most PAGE_SAMPLES of them. Pages that are
+    not present or live on a node past STAT_NODES count as unknown.
+*/
+static void samplePages(const framebuffer *fb, long start, long run, thread_stat *st) {
+    size_t psize = pixelSize(fb->format);
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    long first_y = start / fb->size.x, last_y = (start + run - 1) / fb->size.x;
+
+    uintptr_t first = (uintptr_t)(fb->data + (first_y - fb->first_row) * fb->stride + (start % fb->size.x) * psize);
+    uintptr_t last = (uintptr_t)(fb->data + (last_y - fb->first_row) * fb->stride + ((start + run - 1) % fb->size.x) * psize);
+
+    first &= ~(page_size - 1);
+    last &= ~(page_size - 1);
+
+    unsigned long count = (last - first) / page_size + 1;
+    unsigned long step = count > PAGE_SAMPLES ? count / PAGE_SAMPLES : 1;
+    if(count > PAGE_SAMPLES) count = PAGE_SAMPLES;
+
+    void *pages[PAGE_SAMPLES];
+    int status[PAGE_SAMPLES];
 
-    for(long x = a.x; x < targ->size.x; x++) {
-        targ->map[x + a.y * targ->size.x] = determinePixelColor(targ->anchors, targ->anchors_size, (point){x, a.y});
+    for(unsigned long idx = 0; idx < count; idx++) {
+        pages[idx] = (void*)(first + idx * step * page_size);
     }
 
-    for(long y = a.y + 1; y < b.y; y++) {
-        for(long x = 0; x < targ->size.x; x++) {
-            targ->map[x + y * targ->size.x] = determinePixelColor(targ->anchors, targ->anchors_size, (point){x, y});
-        }
+    if(syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) {
+        st->pages_unknown += count;
+        return;
+    }
+
+    for(unsigned long idx = 0; idx < count; idx++) {
+        if(status[idx] >= 0 && status[idx] < STAT_NODES) st->pages[status[idx]]++;
+        else st->pages_unknown++;
     }
+}
 
-    for(long x = 0; x < b.x; x++) {
-        targ->map[x + b.y * targ->size.x] = determinePixelColor(targ->anchors, targ->anchors_size, (point){x, b.y});
+static void accumulatePixel(cell_accum *cells, size_t nearest, point p) {
+    cell_accum *cell = &cells[nearest];
+
+    if(cell->area == 0) {
+        cell->min = p;
+        cell->max = p;
+    } else {
+        if(p.x < cell->min.x) cell->min.x = p.x;
+        if(p.x > cell->max.x) cell->max.x = p.x;
+        if(p.y < cell->min.y) cell->min.y = p.y;
+        if(p.y > cell->max.y) cell->max.y = p.y;
     }
 
-    return (void*)(int)1;
+    cell->area++;
+    cell->sum_x += p.x;
+    cell->sum_y += p.y;
 }
 
-int generateVoronoi(color *buffer, point size, const anchor *anchors, size_t num_anchors) {
-    long area = size.x * size.y;
-    long threads = sysconf(_SC_NPROCESSORS_CONF);
-    long chunk = area / threads;
-    long rem = area - threads * chunk;
+static int compareEdges(const void *lhs, const void *rhs) {
+    const cell_edge *l = lhs;
+    const cell_edge *r = rhs;
 
-    if(threads == 1) {
-        for(int y = 0; y < size.y; y++) {
-            for(int x = 0; x < size.x; x++) {
-                buffer[x + y * size.x] = determinePixelColor(anchors, num_anchors, (point){x, y});
-            }
+    if(l->a != r->a) return l->a < r->a ? -1 : 1;
+    if(l->b != r->b) return l->b < r->b ? -1 : 1;
+    return 0;
+}
+
+size_t uniqueEdges(cell_edge *edges, size_t size) {
+    if(size == 0) return 0;
+
+    qsort(edges, size, sizeof(cell_edge), compareEdges);
+
+    size_t kept = 1;
+    for(size_t idx = 1; idx < size; idx++) {
+        if(compareEdges(&edges[kept - 1], &edges[idx]) != 0) {
+            edges[kept++] = edges[idx];
         }
-    } else {
-        long total = 0;
-        long thread_count = 0;
-        bool partition = true;
+    }
 
-        pthread_t th[threads];
-        task_arg *args[threads];
+    return kept;
+}
 
-        while(partition) {
-            long run;
+/*
+    Neighboring pixels mostly repeat the edge that was added last, the rest
+    of the duplicates are dropped whenever the list fills up.
+*/
+static int addEdge(task_arg *targ, size_t a, size_t b) {
+    if(a == b) return 1;
+
+    if(a > b) {
+        size_t tmp = a;
+        a = b;
+        b = tmp;
+    }
 
-            if(thread_count + 1 == threads || total + chunk + rem >= area) {
-                run = chunk + rem;
-                partition = false;
-            } else run = chunk;
+    if(targ->edges_size > 0) {
+        const cell_edge *last = &targ->edges[targ->edges_size - 1];
+        if(last->a == a && last->b == b) return 1;
+    }
 
-            args[thread_count] = malloc(sizeof(task_arg));
+    if(targ->edges_size == targ->edges_capacity) {
+        targ->edges_size = uniqueEdges(targ->edges, targ->edges_size);
 
-            args[thread_count]->start = total;
-            args[thread_count]->size = size;
-            args[thread_count]->run = run;
-            args[thread_count]->anchors = anchors;
-            args[thread_count]->anchors_size = num_anchors;
-            args[thread_count]->map = buffer;
+        if(targ->edges_size >= targ->edges_capacity / 2) {
+            size_t capacity = targ->edges_capacity ? targ->edges_capacity * 2 : 256;
+            cell_edge *edges = realloc(targ->edges, capacity * sizeof(cell_edge));
+            if(!edges) return 0;
 
-            if(pthread_create(&th[thread_count], NULL, calculateChunk, args[thread_count]) != 0) {
-                warn("Failed to create thread\n");
-                return 0;
-            }
+            targ->edges = edges;
+            targ->edges_capacity = capacity;
+        }
+    }
+
+    targ->edges[targ->edges_size++] = (cell_edge){a, b};
+    return 1;
+}
+
+/* The owners of the last three rows a thread has looked at, indexed by y % 3 */
+typedef struct owner_rows {
+    size_t *rows[3];
+    long loaded[3];
+} owner_rows;
+
+/* Coordinates below this give the same score in integers and doubles */
+#define QUERY_EXACT (1L << 24)
+
+#define ABS(v) ((v) < 0 ? -(v) : (v))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define KERNEL_SUFFIX Euclidean
+#define KERNEL_TYPE long
+#define KERNEL_MAX LONG_MAX
+#define KERNEL_SCORE(dx, dy, w) ((dx) * (dx) + (dy) * (dy))
+#define KERNEL_SLACK(dx, dy, w) (M_SQRT2 * sqrt((dx) * (dx) + (dy) * (dy)) + 0.5)
+#include "./kernel.h"
+
+#define KERNEL_SUFFIX Manhattan
+#define KERNEL_TYPE long
+#define KERNEL_MAX LONG_MAX
+#define KERNEL_SCORE(dx, dy, w) (ABS(dx) + ABS(dy))
+#define KERNEL_SLACK(dx, dy, w) 1.0
+#include "./kernel.h"
+
+#define KERNEL_SUFFIX Chebyshev
+#define KERNEL_TYPE long
+#define KERNEL_MAX LONG_MAX
+#define KERNEL_SCORE(dx, dy, w) MAX(ABS(dx), ABS(dy))
+#define KERNEL_SLACK(dx, dy, w) 0.5
+#include "./kernel.h"
+
+#define KERNEL_SUFFIX Additive
+#define KERNEL_TYPE double
+#define KERNEL_MAX HUGE_VAL
+#define KERNEL_SCORE(dx, dy, w) (sqrt((dx) * (dx) + (dy) * (dy)) - (w))
+#define KERNEL_SLACK(dx, dy, w) M_SQRT1_2
+#include "./kernel.h"
+
+#define KERNEL_SUFFIX Multiplicative
+#define KERNEL_TYPE double
+#define KERNEL_MAX HUGE_VAL
+#define KERNEL_SCORE(dx, dy, w) (sqrt((dx) * (dx) + (dy) * (dy)) / (w))
+#define KERNEL_SLACK(dx, dy, w) (M_SQRT1_2 / (w))
+#include "./kernel.h"
+
+#define KERNEL_SUFFIX Power
+#define KERNEL_TYPE long
+#define KERNEL_MAX LONG_MAX
+#define KERNEL_SCORE(dx, dy, w) ((dx) * (dx) + (dy) * (dy) - (w))
+#define KERNEL_SLACK(dx, dy, w) (M_SQRT2 * sqrt((dx) * (dx) + (dy) * (dy)) + 0.5)
+#include "./kernel.h"
+
+static void *(*const chunk_kernels[])(void *) = {
+    [METRIC_EUCLIDEAN] = calculateChunkEuclidean,
+    [METRIC_MANHATTAN] = calculateChunkManhattan,
+    [METRIC_CHEBYSHEV] = calculateChunkChebyshev,
+    [METRIC_ADDITIVE] = calculateChunkAdditive,
+    [METRIC_MULTIPLICATIVE] = calculateChunkMultiplicative,
+    [METRIC_POWER] = calculateChunkPower,
+};
+
+static void *(*const query_kernels[])(void *) = {
+    [METRIC_EUCLIDEAN] = queryChunkEuclidean,
+    [METRIC_MANHATTAN] = queryChunkManhattan,
+    [METRIC_CHEBYSHEV] = queryChunkChebyshev,
+    [METRIC_ADDITIVE] = queryChunkAdditive,
+    [METRIC_MULTIPLICATIVE] = queryChunkMultiplicative,
+    [METRIC_POWER] = queryChunkPower,
+};
+
+size_t determinePixelAnchor(const anchor *anchors, size_t size, point target) {
+    return nearestPixelEuclidean(anchors, size, target);
+}
+
+color determinePixelColor(const anchor *anchors, size_t size, point target) {
+    return anchors[determinePixelAnchor(anchors, size, target)].col;
+}
+
+void *calculateChunk(void *arg) {
+    return chunk_kernels[((task_arg*)arg)->metric](arg);
+}
 
-            total += run;
-            thread_count++;
+/*
+    Huge pages are taken from the reserved pool when possible, otherwise
+    transparent huge pages are requested for a regular mapping. The pages
+    are not touched here so that each one is faulted in on the NUMA node of
+    the worker thread that renders into it first.
+*/
+void *allocatePixels(size_t length, bool huge, size_t *mapped) {
+    void *addr = MAP_FAILED;
+
+    if(huge) {
+        size_t rounded = (length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        addr = mmap(NULL, rounded, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(addr != MAP_FAILED) {
+            *mapped = rounded;
+            return addr;
         }
+    }
+
+    addr = mmap(NULL, length, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) return NULL;
+
+    if(huge && madvise(addr, length, MADV_HUGEPAGE) == -1) {
+        warn("madvise()");
+    }
+
+    *mapped = length;
+    return addr;
+}
 
-        for(long t = 0; t < thread_count; t++) {
-            pthread_join(th[t], NULL);
+/*
+    The rate is the output written per second of render time, which is
+    bound by the distance computations rather than by memory bandwidth.
+    Page placement comes from samplePages().
+*/
+static void printStats(task_arg **args, long count, pixel_format format) {
+    long pages[STAT_NODES] = {0};
+    long pages_unknown = 0;
+    long threads[STAT_NODES] = {0};
+
+    for(long t = 0; t < count; t++) {
+        const thread_stat *st = &args[t]->stat;
+        double bytes = (double)st->pixels * pixelSize(format);
+
+        fprintf(stderr, "thread %ld: ran on cpu %u node %u, %ld pixels in %.3fs, %.1f MB/s output, %ld supersampled, sampled pages:",
+                t, st->cpu, st->node, st->pixels, st->seconds, bytes / st->seconds / 1e6, st->supersampled);
+
+        for(unsigned node = 0; node < STAT_NODES; node++) {
+            if(st->pages[node]) fprintf(stderr, " node %u %ld,", node, st->pages[node]);
+            pages[node] += st->pages[node];
         }
 
-        for(long idx = 0; idx < thread_count; idx++) {
-            free(args[idx]);
+        fprintf(stderr, " unknown %ld\n", st->pages_unknown);
+        pages_unknown += st->pages_unknown;
+        if(st->node < STAT_NODES) threads[st->node]++;
+    }
+
+    for(unsigned node = 0; node < STAT_NODES; node++) {
+        if(threads[node] == 0 && pages[node] == 0) continue;
+        fprintf(stderr, "node %u: %ld threads finished here, %ld sampled pages placed here\n",
+                node, threads[node], pages[node]);
+    }
+
+    if(pages_unknown) fprintf(stderr, "%ld sampled pages on an unknown node\n", pages_unknown);
+}
+
+static long taskCount(const render_options *opts) {
+    if(opts->pool) return poolSize(opts->pool);
+    if(opts->threads > 0) return opts->threads;
+
+    long threads = sysconf(_SC_NPROCESSORS_CONF);
+    return threads > 0 ? threads : 1;
+}
+
+/*
+    Runs the tasks on the pool of the options, or on a pool started just
+    for them. Pinning happens when the pool starts its threads, before any
+    of them first touches the framebuffer.
+*/
+static int runTasks(void *(*fn)(void *), void **tasks, long count, const render_options *opts) {
+    thread_pool *pool = opts->pool;
+
+    if(!pool) {
+        if(count == 1 && !opts->pin) {
+            fn(tasks[0]);
+            return 1;
+        }
+
+        pool = poolCreate(count, opts->pin);
+        if(!pool) {
+            warnx("Failed to create threads");
+            return 0;
         }
     }
 
+    poolRun(pool, fn, tasks, count);
+
+    if(pool != opts->pool) poolDestroy(pool);
     return 1;
 }
 
-int generatePNG(const char *filename, const color *color_map, point size) {
-    FILE *fp;
-    png_structp pngp = NULL;
-    png_infop infop = NULL;
-    png_byte **rows = NULL;
-    int pixel_size =3;
-    int depth = 8;
-
-    fp = fopen(filename, "wb+");
-    if(!fp) {
-        warn("Failed to open %s", filename);
-        return 0;
+/*
+    PATTERN_GRID places n * n samples on a regular grid, PATTERN_ROOKS places
+    n samples so that no two share a row or a column of that grid, which
+    gives a similar quality on near horizontal and vertical edges for a
+    fraction of the samples.
+*/
+static long gcd(long a, long b) {
+    while(b) {
+        long t = a % b;
+        a = b;
+        b = t;
     }
 
-    pngp = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if(pngp == NULL) {
-        warnx("png_create_write_struct()");
-        return 0;
-    }
+    return a;
+}
 
-    infop = png_create_info_struct(pngp);
+static size_t samplePattern(sample_pattern pattern, long n, sample *samples) {
+    size_t count = 0;
 
-    if(infop == NULL) {
-        warnx("Failed call to png_create_info_struct()");
-        return 0;
+    if(pattern == PATTERN_ROOKS) {
+        long step = n / 2 + 1;
+        while(gcd(n, step) != 1) step++;
+
+        for(long i = 0; i < n; i++) {
+            samples[count++] = (sample){
+                (i + 0.5) / n - 0.5,
+                ((i * step) % n + 0.5) / n - 0.5
+            };
+        }
+    } else {
+        for(long j = 0; j < n; j++) {
+            for(long i = 0; i < n; i++) {
+                samples[count++] = (sample){(i + 0.5) / n - 0.5, (j + 0.5) / n - 0.5};
+            }
+        }
     }
 
-    png_set_IHDR(pngp, infop, size.x, size.y, depth,
-            PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
-            );
-
-    rows = png_malloc(pngp, size.y * sizeof(png_byte *));
-    for(long r = 0; r < size.y; r++) {
-        png_byte *row = png_malloc(pngp, size.x * pixel_size);
-        rows[r] = row;
-        for(long c = 0; c < size.x; c++) {
-            color col = color_map[c + r * size.x];
-            *row++ = col.red;
-            *row++ = col.green;
-            *row++ = col.blue;
+    return count;
+}
+
+static int mergeStats(cell_stats *stats, task_arg **args, long count, size_t num_anchors) {
+    memset(stats->cells, 0, num_anchors * sizeof(cell_accum));
+
+    for(long t = 0; t < count; t++) {
+        for(size_t idx = 0; idx < num_anchors; idx++) {
+            cell_accum *dst = &stats->cells[idx];
+            const cell_accum *src = &args[t]->cells[idx];
+            if(src->area == 0) continue;
+
+            if(dst->area == 0) {
+                dst->min = src->min;
+                dst->max = src->max;
+            } else {
+                if(src->min.x < dst->min.x) dst->min.x = src->min.x;
+                if(src->min.y < dst->min.y) dst->min.y = src->min.y;
+                if(src->max.x > dst->max.x) dst->max.x = src->max.x;
+                if(src->max.y > dst->max.y) dst->max.y = src->max.y;
+            }
+
+            dst->area += src->area;
+            dst->sum_x += src->sum_x;
+            dst->sum_y += src->sum_y;
         }
     }
 
-    png_init_io(pngp, fp);
-    png_set_rows(pngp, infop, rows);
-    png_write_png(pngp, infop, PNG_TRANSFORM_IDENTITY, NULL);
+    stats->edges = NULL;
+    stats->edges_size = 0;
+    if(!stats->adjacency) return 1;
+
+    size_t total = 0;
+    for(long t = 0; t < count; t++) {
+        total += args[t]->edges_size;
+    }
+
+    stats->edges = malloc((total ? total : 1) * sizeof(cell_edge));
+    if(!stats->edges) {
+        warn("Failed to allocate %zu bytes", total * sizeof(cell_edge));
+        return 0;
+    }
 
-    for(long r = 0; r < size.y; r++) {
-        png_free(pngp, rows[r]);
+    for(long t = 0; t < count; t++) {
+        memcpy(stats->edges + stats->edges_size, args[t]->edges, args[t]->edges_size * sizeof(cell_edge));
+        stats->edges_size += args[t]->edges_size;
     }
 
-    png_free(pngp, rows);
-    png_destroy_write_struct(&pngp, &infop);
-    fclose(fp);
+    stats->edges_size = uniqueEdges(stats->edges, stats->edges_size);
     return 1;
 }
 
-int generateGIF(const char *filename, anchor *anchors, size_t anchors_size, color *color_map, point size, size_t frames, int velocity, bool keep) {
-    MagickWandGenesis();
-    MagickWand *wand = NewMagickWand();
-    MagickBooleanType status;
-    /*MagickSetCompression(wand, BZipCompression);*/
+/*
+    Handles the `area` pixels from index `first` on, split evenly between
+    the threads. Renders into `fb` when it is given and collects the
+    statistics of every cell into `stats` when that is given. Each thread
+    accumulates into its own arrays, they are merged once all threads are
+    joined.
+*/
+static int accumulateRange(const framebuffer *fb, point size, long first, long area, const anchor *anchors, size_t num_anchors, cell_stats *stats, const render_options *opts) {
+    render_options defaults = NEW_RENDER_OPTIONS();
+    if(!opts) opts = &defaults;
 
-    point direction[] = {
-        {-1, 0}, {-1, 1}, {0, 1}, {1, 1},
-        {1, 0}, {1, -1}, {0, -1}, {-1, -1}
-    };
-
-    static const size_t direction_size = sizeof(direction) / sizeof(direction[0]);
+    long threads = taskCount(opts);
+    if(threads > area) threads = area;
 
-    static char filepath[PATH_MAX];
-    for(size_t frame = 1; frame <= frames; frame++) {
-        sprintf(filepath, "frame_%zu.png", frame);
+    long chunk = area / threads;
+    long rem = area - threads * chunk;
+    long total = 0;
 
-        for(size_t idx = 0; idx < anchors_size; idx++) {
-            size_t dir = random() % direction_size;
-            point step = direction[dir];
-            anchors[idx].pos.x += step.x * velocity;
-            anchors[idx].pos.y += step.y * velocity;
-        }
+    /* Anti-aliasing blends colors, so it does not apply to an index image */
+    bool smooth = fb && fb->format != PIXEL_INDEX && opts->antialias > 1;
+    sample *samples = NULL;
+    size_t samples_size = 0;
 
-        if(generateVoronoi(color_map, size, anchors, anchors_size) == 0) {
-            warnx("Failed to generate diagram");
+    if(smooth) {
+        /* Keeps antialias * antialias from overflowing */
+        if(opts->antialias > MAX_ANTIALIAS) {
+            warnx("At most %d samples per side are supported", MAX_ANTIALIAS);
             return 0;
         }
 
-        if(generatePNG(filepath, color_map, size) == 0) {
-            warnx("Failed to generate PNG image");
+        samples = malloc(opts->antialias * opts->antialias * sizeof(sample));
+        if(!samples) {
+            warn("Failed to allocate memory");
             return 0;
         }
 
-        MagickReadImage(wand, filepath);
+        samples_size = samplePattern(opts->pattern, opts->antialias, samples);
     }
 
-    status = MagickWriteImages(wand, filename, MagickTrue);
+    long thread_count = 0;
+    bool partition = true;
+    int ret = 1;
 
-    if(status == MagickFalse) {
-        ExceptionType severity;
-        char *description = MagickGetException(wand,&severity);
-        (void) warnx("%s %s %lu %s\n",GetMagickModule(),description);
-        description= (char *) MagickRelinquishMemory(description);
-        return 0;
+    task_arg *args[threads];
+    void *tasks[threads];
+
+    while(partition) {
+        long run;
+
+        if(thread_count + 1 == threads || total + chunk + rem >= area) {
+            run = chunk + rem;
+            partition = false;
+        } else run = chunk;
+
+        args[thread_count] = calloc(1, sizeof(task_arg));
+        if(!args[thread_count]) {
+            warn("Failed to allocate memory");
+            ret = 0;
+            break;
+        }
+
+        args[thread_count]->start = first + total;
+        args[thread_count]->run = run;
+        args[thread_count]->size = size;
+        args[thread_count]->anchors = anchors;
+        args[thread_count]->anchors_size = num_anchors;
+        args[thread_count]->fb = fb;
+        args[thread_count]->metric = opts->metric;
+        args[thread_count]->verbose = opts->verbose;
+        args[thread_count]->samples = samples;
+        args[thread_count]->samples_size = samples_size;
+        tasks[thread_count] = args[thread_count];
+
+        if(stats) {
+            args[thread_count]->adjacency = stats->adjacency;
+            args[thread_count]->cells = calloc(num_anchors, sizeof(cell_accum));
+            if(!args[thread_count]->cells) {
+                warn("Failed to allocate memory");
+                free(args[thread_count]);
+                ret = 0;
+                break;
+            }
+        }
+
+        total += run;
+        thread_count++;
+    }
+
+    if(ret && runTasks(chunk_kernels[opts->metric], tasks, thread_count, opts) == 0) {
+        ret = 0;
     }
 
-    if(!keep) {
-        for(size_t frame = 1; frame <= frames; frame++) {
-            sprintf(filepath, "frame_%zu.png", frame);
-            remove(filepath);
+    for(long t = 0; ret && t < thread_count; t++) {
+        if(args[t]->failed) {
+            warnx("Failed to allocate memory in thread %ld", t);
+            ret = 0;
         }
     }
 
-    wand = DestroyMagickWand(wand);
-    MagickWandTerminus();
-    return 1;
+    if(ret && fb && opts->verbose) printStats(args, thread_count, fb->format);
+
+    if(ret && stats && mergeStats(stats, args, thread_count, num_anchors) == 0) {
+        ret = 0;
+    }
+
+    for(long idx = 0; idx < thread_count; idx++) {
+        free(args[idx]->cells);
+        free(args[idx]->edges);
+        free(args[idx]);
+    }
+
+    free(samples);
+    return ret;
+}
+
+int accumulateCells(const framebuffer *fb, point size, const anchor *anchors, size_t num_anchors, cell_stats *stats, const render_options *opts) {
+    return accumulateRange(fb, size, 0, size.x * size.y, anchors, num_anchors, stats, opts);
+}
+
+/*
+    Renders only the pixels from index `start` to `start + run`, `fb` needs
+    to hold just the rows they span starting at `fb->first_row`.
+*/
+int generateRange(const framebuffer *fb, long start, long run, const anchor *anchors, size_t num_anchors, const render_options *opts) {
+    return accumulateRange(fb, fb->size, start, run, anchors, num_anchors, NULL, opts);
+}
+
+/*
+    Finds the anchor nearest to each of the `count` points, stored as x, y
+    pairs in `points`, with the same kernels used for rendering.
+*/
+int queryAnchors(const anchor *anchors, size_t num_anchors, const double *points, size_t count, size_t *nearest, const render_options *opts) {
+    render_options defaults = NEW_RENDER_OPTIONS();
+    if(!opts) opts = &defaults;
+
+    if(count == 0) return 1;
+
+    long threads = taskCount(opts);
+    if((size_t)threads > count) threads = count;
+
+    size_t chunk = count / threads;
+    size_t rem = count - threads * chunk;
+    size_t total = 0;
+
+    query_arg args[threads];
+    void *tasks[threads];
+
+    for(long t = 0; t < threads; t++) {
+        size_t run = chunk + (t + 1 == threads ? rem : 0);
+
+        args[t] = (query_arg){
+            .start = total,
+            .run = run,
+            .anchors = anchors,
+            .anchors_size = num_anchors,
+            .points = points,
+            .nearest = nearest
+        };
+
+        tasks[t] = &args[t];
+        total += run;
+    }
+
+    return runTasks(query_kernels[opts->metric], tasks, threads, opts);
+}
+
+int generateVoronoi(const framebuffer *fb, const anchor *anchors, size_t num_anchors, const render_options *opts) {
+    return accumulateCells(fb, fb->size, anchors, num_anchors, NULL, opts);
 }
@@ -3,23 +3,103 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
-typedef struct point {
-    long x;
-    long y;
-} point;
+#include "./types.h"
 
-typedef struct color {
-    uint8_t red;
-    uint8_t green;
-    uint8_t blue;
-} color;
+/*
+    A rectangle of pixels that the render workers write to in place,
+    rows are `stride` bytes apart. PIXEL_RGB and PIXEL_BGR use 3 bytes per
+    pixel, PIXEL_INDEX stores the index of the nearest anchor as a uint32_t.
+    `data` starts at row `first_row` of an image of `size`, which is 0
+    unless only a part of the image is rendered.
+*/
+typedef struct framebuffer {
+    uint8_t *data;
+    point size;
+    size_t stride;
+    pixel_format format;
+    long first_row;
+} framebuffer;
+
+struct thread_pool;
+
+/*
+    `antialias` is the number of samples along each side of a pixel, pixels
+    on the border between cells are supersampled when it is more than 1.
+    It can be at most MAX_ANTIALIAS.
+    Rendering runs on `pool` when it is set, otherwise threads are started
+    for every render.
+*/
+typedef struct render_options {
+    distance_metric metric;
+    long threads;
+    bool pin;
+    bool verbose;
+    long antialias;
+    sample_pattern pattern;
+    struct thread_pool *pool;
+} render_options;
+
+#define NEW_RENDER_OPTIONS() (render_options){ \
+    .metric = METRIC_EUCLIDEAN, \
+    .threads = 0, \
+    .pin = false, \
+    .verbose = false, \
+    .antialias = 0, \
+    .pattern = PATTERN_GRID, \
+    .pool = NULL \
+}
+
+/* Offset of a sample from the center of a pixel */
+typedef struct sample {
+    double x;
+    double y;
+} sample;
+
+#define STAT_NODES 16
 
+/*
+    `cpu` and `node` are where the thread was running when it finished,
+    `pages` counts a sample of the framebuffer pages of its chunk by the
+    node they were placed on, as reported by move_pages().
+*/
+typedef struct thread_stat {
+    long pixels;
+    long supersampled;
+    double seconds;
+    unsigned cpu;
+    unsigned node;
+    long pages[STAT_NODES];
+    long pages_unknown;
+} thread_stat;
 
-typedef struct anchor {
-    point pos;
-    color col;
-} anchor;
+/* Running sums over the pixels owned by one anchor */
+typedef struct cell_accum {
+    long area;
+    long sum_x;
+    long sum_y;
+    point min;
+    point max;
+} cell_accum;
+
+/* Two anchors whose cells share a border, `a` is always less than `b` */
+typedef struct cell_edge {
+    size_t a;
+    size_t b;
+} cell_edge;
+
+/*
+    `cells` is provided by the caller and holds one entry per anchor, when
+    `adjacency` is set `edges` is allocated and filled with every pair of
+    neighboring cells and has to be freed by the caller.
+*/
+typedef struct cell_stats {
+    cell_accum *cells;
+    bool adjacency;
+    cell_edge *edges;
+    size_t edges_size;
+} cell_stats;
 
 typedef struct task_arg {
     long start;
@@ -27,15 +107,40 @@ typedef struct task_arg {
     point size;
     const anchor *anchors;
     size_t anchors_size;
-    color *map;
+    const framebuffer *fb;
+    distance_metric metric;
+    const sample *samples;
+    size_t samples_size;
+    cell_accum *cells;
+    bool adjacency;
+    cell_edge *edges;
+    size_t edges_size;
+    size_t edges_capacity;
+    bool failed;
+    bool verbose;
+    thread_stat stat;
 } task_arg;
 
+typedef struct query_arg {
+    size_t start;
+    size_t run;
+    const anchor *anchors;
+    size_t anchors_size;
+    const double *points;
+    size_t *nearest;
+} query_arg;
+
 point randomPoint(point);
 color randomColor(void);
+size_t determinePixelAnchor(const anchor *, size_t, point);
 color determinePixelColor(const anchor *, size_t, point);
 void *calculateChunk(void *);
-int generateVoronoi(color *, point, const anchor *, size_t);
-int generatePNG(const char *, const color *, point);
-int generateGIF(const char *, anchor *, size_t, color *, point, size_t, int, bool);
+size_t pixelSize(pixel_format);
+void *allocatePixels(size_t, bool, size_t *);
+size_t uniqueEdges(cell_edge *, size_t);
+int accumulateCells(const framebuffer *, point, const anchor *, size_t, cell_stats *, const render_options *);
+int generateVoronoi(const framebuffer *, const anchor *, size_t, const render_options *);
+int generateRange(const framebuffer *, long, long, const anchor *, size_t, const render_options *);
+int queryAnchors(const anchor *, size_t, const double *, size_t, size_t *, const render_options *);
 
 #endif
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "./cell.h"
+
+static long distance(point a, point b) {
+    long dx = labs(a.x - b.x);
+    long dy = labs(a.y - b.y);
+    return dx > dy ? dx : dy;
+}
+
+/*
+    Lloyd relaxation, every iteration moves each anchor to the centroid of
+    its cell. Stops early once no anchor moved more than `threshold` pixels
+    along either axis.
+*/
+int relaxAnchors(anchor *anchors, size_t num_anchors, point size, long iterations, long threshold, const render_options *opts) {
+    cell_accum *cells = calloc(num_anchors, sizeof(cell_accum));
+    if(!cells) {
+        warn("Failed to allocate %zu bytes", num_anchors * sizeof(cell_accum));
+        return 0;
+    }
+
+    cell_stats stats = { .cells = cells, .adjacency = false };
+
+    for(long iter = 1; iter <= iterations; iter++) {
+        if(accumulateCells(NULL, size, anchors, num_anchors, &stats, opts) == 0) {
+            free(cells);
+            return 0;
+        }
+
+        long moved = 0;
+
+        for(size_t idx = 0; idx < num_anchors; idx++) {
+            const cell_accum *cell = &cells[idx];
+            if(cell->area == 0) continue;
+
+            point centroid = {
+                (cell->sum_x + cell->area / 2) / cell->area,
+                (cell->sum_y + cell->area / 2) / cell->area
+            };
+
+            long d = distance(anchors[idx].pos, centroid);
+            if(d > moved) moved = d;
+
+            anchors[idx].pos = centroid;
+        }
+
+        if(opts && opts->verbose) {
+            fprintf(stderr, "relaxation %ld: anchors moved up to %ld pixels\n", iter, moved);
+        }
+
+        if(moved <= threshold) break;
+    }
+
+    free(cells);
+    return 1;
+}
+
+/*
+    Writes one CSV row per anchor, the neighbors column lists the indices of
+    the adjacent cells separated by spaces.
+*/
+int writeCellStats(const char *filename, const anchor *anchors, size_t num_anchors, const cell_stats *stats) {
+    size_t *offsets = calloc(num_anchors + 1, sizeof(size_t));
+    size_t *neighbors = malloc((2 * stats->edges_size + 1) * sizeof(size_t));
+
+    if(!offsets || !neighbors) {
+        warn("Failed to allocate memory");
+        free(offsets);
+        free(neighbors);
+        return 0;
+    }
+
+    for(size_t idx = 0; idx < stats->edges_size; idx++) {
+        offsets[stats->edges[idx].a + 1]++;
+        offsets[stats->edges[idx].b + 1]++;
+    }
+
+    for(size_t idx = 0; idx < num_anchors; idx++) {
+        offsets[idx + 1] += offsets[idx];
+    }
+
+    for(size_t idx = 0; idx < stats->edges_size; idx++) {
+        const cell_edge *e = &stats->edges[idx];
+        neighbors[offsets[e->a]++] = e->b;
+        neighbors[offsets[e->b]++] = e->a;
+    }
+
+    /* The fill above moved every offset to the start of the next anchor */
+    memmove(offsets + 1, offsets, num_anchors * sizeof(size_t));
+    offsets[0] = 0;
+
+    FILE *fp = fopen(filename, "w");
+    if(!fp) {
+        warn("Failed to open %s", filename);
+        free(offsets);
+        free(neighbors);
+        return 0;
+    }
+
+    fprintf(fp, "anchor,x,y,area,centroid_x,centroid_y,min_x,min_y,max_x,max_y,neighbors\n");
+
+    for(size_t idx = 0; idx < num_anchors; idx++) {
+        const cell_accum *cell = &stats->cells[idx];
+        double cx = cell->area ? (double)cell->sum_x / cell->area : 0;
+        double cy = cell->area ? (double)cell->sum_y / cell->area : 0;
+
+        fprintf(fp, "%zu,%ld,%ld,%ld,%.3f,%.3f,%ld,%ld,%ld,%ld,", idx,
+                anchors[idx].pos.x, anchors[idx].pos.y, cell->area, cx, cy,
+                cell->min.x, cell->min.y, cell->max.x, cell->max.y);
+
+        for(size_t n = offsets[idx]; n < offsets[idx + 1]; n++) {
+            fprintf(fp, n == offsets[idx] ? "%zu" : " %zu", neighbors[n]);
+        }
+
+        fputc('\n', fp);
+    }
+
+    free(offsets);
+    free(neighbors);
+
+    if(fclose(fp) == EOF) {
+        warn("Failed to write %s", filename);
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,10 @@
+#ifndef VORONOI_CELL_H
+#define VORONOI_CELL_H
+
+#include <stddef.h>
+#include "./canvas.h"
+
+int relaxAnchors(anchor *, size_t, point, long, long, const render_options *);
+int writeCellStats(const char *, const anchor *, size_t, const cell_stats *);
+
+#endif
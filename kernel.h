@@ -0,0 +1,247 @@
+/*
+    The render kernel, canvas.c includes this file once for every distance
+    metric so the metric is compiled into the loops instead of being looked
+    up for every pixel. Before including it define:
+
+    KERNEL_SUFFIX             appended to the name of every function
+    KERNEL_TYPE               type of the score of a pixel center
+    KERNEL_MAX                largest value of KERNEL_TYPE
+    KERNEL_SCORE(dx, dy, w)   score of an anchor at offset (dx, dy) with
+                              weight w, the lowest score owns the point
+    KERNEL_SLACK(dx, dy, w)   how much the score can change anywhere
+                              within half a pixel diagonal of the point
+*/
+
+#define KERNEL_JOIN_(name, suffix) name ## suffix
+#define KERNEL_JOIN(name, suffix) KERNEL_JOIN_(name, suffix)
+#define KERNEL_FN(name) KERNEL_JOIN(name, KERNEL_SUFFIX)
+
+static size_t KERNEL_FN(nearestPixel)(const anchor *anchors, size_t size, point target) {
+    KERNEL_TYPE min = KERNEL_MAX;
+    size_t nearest = 0;
+
+    for(size_t idx = 0; idx < size; idx++) {
+        KERNEL_TYPE dx = anchors[idx].pos.x - target.x;
+        KERNEL_TYPE dy = anchors[idx].pos.y - target.y;
+        KERNEL_TYPE current = KERNEL_SCORE(dx, dy, anchors[idx].weight);
+
+        if(min > current) {
+            min = current;
+            nearest = idx;
+        }
+    }
+
+    return nearest;
+}
+
+static size_t KERNEL_FN(nearestPoint)(const anchor *anchors, size_t size, double x, double y) {
+    double min = HUGE_VAL;
+    size_t nearest = 0;
+
+    for(size_t idx = 0; idx < size; idx++) {
+        double dx = anchors[idx].pos.x - x;
+        double dy = anchors[idx].pos.y - y;
+        double current = KERNEL_SCORE(dx, dy, (double)anchors[idx].weight);
+
+        if(min > current) {
+            min = current;
+            nearest = idx;
+        }
+    }
+
+    return nearest;
+}
+
+static const size_t *KERNEL_FN(ownerRow)(owner_rows *ring, const task_arg *targ, long y) {
+    size_t *row = ring->rows[y % 3];
+
+    if(ring->loaded[y % 3] != y) {
+        for(long x = 0; x < targ->size.x; x++) {
+            row[x] = KERNEL_FN(nearestPixel)(targ->anchors, targ->anchors_size, (point){x, y});
+        }
+
+        ring->loaded[y % 3] = y;
+    }
+
+    return row;
+}
+
+/*
+    The score of an anchor changes by at most its slack between the center
+    and any sample, so only the anchors whose lowest possible score is not
+    above the highest possible score of the owner of the center can win a
+    sample. Those are gathered into `near` first, keeping their order so
+    that ties resolve the same way.
+*/
+static color KERNEL_FN(blendSamples)(const task_arg *targ, point p, size_t owner, anchor *near) {
+    const anchor *anchors = targ->anchors;
+    const anchor *a = &anchors[owner];
+    double dx = a->pos.x - p.x;
+    double dy = a->pos.y - p.y;
+    double bound = KERNEL_SCORE(dx, dy, (double)a->weight) + KERNEL_SLACK(dx, dy, (double)a->weight);
+    size_t near_size = 0;
+
+    for(size_t idx = 0; idx < targ->anchors_size; idx++) {
+        a = &anchors[idx];
+        dx = a->pos.x - p.x;
+        dy = a->pos.y - p.y;
+
+        if(KERNEL_SCORE(dx, dy, (double)a->weight) - KERNEL_SLACK(dx, dy, (double)a->weight) <= bound) {
+            near[near_size++] = *a;
+        }
+    }
+
+    unsigned long red = 0, green = 0, blue = 0;
+
+    for(size_t idx = 0; idx < targ->samples_size; idx++) {
+        size_t nearest = KERNEL_FN(nearestPoint)(near, near_size,
+                p.x + targ->samples[idx].x, p.y + targ->samples[idx].y);
+        color c = near[nearest].col;
+
+        red += c.red;
+        green += c.green;
+        blue += c.blue;
+    }
+
+    unsigned long count = targ->samples_size;
+    return (color){
+        (red + count / 2) / count,
+        (green + count / 2) / count,
+        (blue + count / 2) / count
+    };
+}
+
+/*
+    Works a row at a time so that the owners of the neighboring pixels are
+    known, the rows overlapping the neighboring chunks are computed again
+    rather than shared between the threads. When anti-aliasing only the
+    pixels with a neighbor owned by a different anchor are supersampled.
+*/
+static void KERNEL_FN(calculateRows)(task_arg *targ) {
+    const framebuffer *fb = targ->fb;
+    owner_rows ring = { .loaded = {-1, -1, -1} };
+    bool smooth = targ->samples_size > 0;
+
+    anchor *near = NULL;
+
+    ring.rows[0] = malloc(3 * targ->size.x * sizeof(size_t));
+    if(smooth) near = malloc(targ->anchors_size * sizeof(anchor));
+
+    if(!ring.rows[0] || (smooth && !near)) {
+        free(ring.rows[0]);
+        free(near);
+        targ->failed = true;
+        return;
+    }
+
+    ring.rows[1] = ring.rows[0] + targ->size.x;
+    ring.rows[2] = ring.rows[1] + targ->size.x;
+
+    point p = {
+        .x = targ->start % targ->size.x,
+        .y = targ->start / targ->size.x
+    };
+
+    const size_t *above = NULL;
+    const size_t *row = NULL;
+    const size_t *below = NULL;
+
+    for(long idx = 0; idx < targ->run; idx++) {
+        if(idx == 0 || p.x == 0) {
+            above = smooth && p.y > 0 ? KERNEL_FN(ownerRow)(&ring, targ, p.y - 1) : NULL;
+            row = KERNEL_FN(ownerRow)(&ring, targ, p.y);
+            below = p.y + 1 < targ->size.y ? KERNEL_FN(ownerRow)(&ring, targ, p.y + 1) : NULL;
+        }
+
+        size_t nearest = row[p.x];
+        size_t right = p.x + 1 < targ->size.x ? row[p.x + 1] : nearest;
+        size_t down = below ? below[p.x] : nearest;
+
+        if(smooth && ((p.x > 0 && row[p.x - 1] != nearest) || right != nearest ||
+                    (above && above[p.x] != nearest) || down != nearest)) {
+            storeColor(fb, p, KERNEL_FN(blendSamples)(targ, p, nearest, near));
+            targ->stat.supersampled++;
+        } else if(fb) {
+            storePixel(fb, p, targ->anchors, nearest);
+        }
+
+        if(targ->cells) accumulatePixel(targ->cells, nearest, p);
+
+        if(targ->adjacency && (addEdge(targ, nearest, right) == 0 || addEdge(targ, nearest, down) == 0)) {
+            targ->failed = true;
+            break;
+        }
+
+        if(++p.x == targ->size.x) {
+            p.x = 0;
+            p.y++;
+        }
+    }
+
+    free(ring.rows[0]);
+    free(near);
+}
+
+static void *KERNEL_FN(calculateChunk)(void *arg) {
+    task_arg *targ = (task_arg*) arg;
+    const framebuffer *fb = targ->fb;
+    struct timespec begin;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    if(targ->adjacency || targ->samples_size > 0) {
+        KERNEL_FN(calculateRows)(targ);
+    } else {
+        point p = {
+            .x = targ->start % targ->size.x,
+            .y = targ->start / targ->size.x
+        };
+
+        for(long idx = 0; idx < targ->run; idx++) {
+            size_t nearest = KERNEL_FN(nearestPixel)(targ->anchors, targ->anchors_size, p);
+            if(fb) storePixel(fb, p, targ->anchors, nearest);
+            if(targ->cells) accumulatePixel(targ->cells, nearest, p);
+
+            if(++p.x == targ->size.x) {
+                p.x = 0;
+                p.y++;
+            }
+        }
+    }
+
+    targ->stat.pixels = targ->run;
+    targ->stat.seconds = elapsed(&begin);
+    syscall(SYS_getcpu, &targ->stat.cpu, &targ->stat.node, NULL);
+    if(fb && targ->verbose) samplePages(fb, targ->start, targ->run, &targ->stat);
+    return (void*)(int)1;
+}
+
+static void *KERNEL_FN(queryChunk)(void *arg) {
+    query_arg *qarg = (query_arg*) arg;
+
+    for(size_t idx = qarg->start; idx < qarg->start + qarg->run; idx++) {
+        double x = qarg->points[2 * idx];
+        double y = qarg->points[2 * idx + 1];
+
+        /*
+            Integral points take the integer loop of the renderer, which
+            picks the same anchor since the scores are exact in both.
+        */
+        if(x == floor(x) && y == floor(y) && fabs(x) < QUERY_EXACT && fabs(y) < QUERY_EXACT) {
+            qarg->nearest[idx] = KERNEL_FN(nearestPixel)(qarg->anchors, qarg->anchors_size, (point){x, y});
+        } else {
+            qarg->nearest[idx] = KERNEL_FN(nearestPoint)(qarg->anchors, qarg->anchors_size, x, y);
+        }
+    }
+
+    return (void*)(int)1;
+}
+
+#undef KERNEL_FN
+#undef KERNEL_JOIN
+#undef KERNEL_JOIN_
+#undef KERNEL_SUFFIX
+#undef KERNEL_TYPE
+#undef KERNEL_MAX
+#undef KERNEL_SCORE
+#undef KERNEL_SLACK
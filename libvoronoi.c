@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./libvoronoi.h"
+#include "./canvas.h"
+#include "./pool.h"
+#include "./cell.h"
+
+struct voronoi_context {
+    anchor *anchors;
+    size_t anchors_size;
+    render_options opts;
+    uint64_t rng;
+};
+
+static const char *error_names[] = {
+    [VORONOI_OK] = "Success",
+    [VORONOI_ENOMEM] = "Out of memory",
+    [VORONOI_EINVAL] = "Invalid argument",
+    [VORONOI_ETHREAD] = "Failed to create threads",
+    [VORONOI_ERENDER] = "Failed to render",
+};
+
+/* xorshift64*, random() shares its state between all callers */
+static uint64_t nextRandom(voronoi_context *ctx) {
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* Anchors that can be passed to the kernels of the current metric */
+static bool validAnchors(const voronoi_context *ctx) {
+    if(ctx->anchors_size == 0) return false;
+    if(ctx->opts.metric != METRIC_MULTIPLICATIVE) return true;
+
+    for(size_t idx = 0; idx < ctx->anchors_size; idx++) {
+        if(ctx->anchors[idx].weight <= 0) return false;
+    }
+
+    return true;
+}
+
+/* `threads` of 0 starts one thread per processor */
+voronoi_context *voronoiCreate(long threads, voronoi_error *error) {
+    voronoi_error dummy;
+    if(!error) error = &dummy;
+
+    if(threads < 0) {
+        *error = VORONOI_EINVAL;
+        return NULL;
+    }
+
+    voronoi_context *ctx = calloc(1, sizeof(voronoi_context));
+    if(!ctx) {
+        *error = VORONOI_ENOMEM;
+        return NULL;
+    }
+
+    render_options defaults = NEW_RENDER_OPTIONS();
+    ctx->opts = defaults;
+    ctx->opts.threads = threads;
+    ctx->opts.pool = poolCreate(threads, false);
+
+    if(!ctx->opts.pool) {
+        free(ctx);
+        *error = VORONOI_ETHREAD;
+        return NULL;
+    }
+
+    ctx->rng = 1;
+    *error = VORONOI_OK;
+    return ctx;
+}
+
+void voronoiDestroy(voronoi_context *ctx) {
+    if(!ctx) return;
+
+    poolDestroy(ctx->opts.pool);
+    free(ctx->anchors);
+    free(ctx);
+}
+
+const char *voronoiError(voronoi_error error) {
+    if((size_t)error >= sizeof(error_names) / sizeof(error_names[0])) return "Unknown error";
+    return error_names[error];
+}
+
+voronoi_error voronoiSeed(voronoi_context *ctx, unsigned long seed) {
+    if(!ctx) return VORONOI_EINVAL;
+
+    /* xorshift never leaves a zero state */
+    ctx->rng = seed ? seed : 1;
+    return VORONOI_OK;
+}
+
+voronoi_error voronoiSetAnchors(voronoi_context *ctx, const anchor *anchors, size_t anchors_size) {
+    if(!ctx || !anchors || anchors_size == 0) return VORONOI_EINVAL;
+
+    anchor *copy = malloc(anchors_size * sizeof(anchor));
+    if(!copy) return VORONOI_ENOMEM;
+
+    memcpy(copy, anchors, anchors_size * sizeof(anchor));
+    free(ctx->anchors);
+    ctx->anchors = copy;
+    ctx->anchors_size = anchors_size;
+    return VORONOI_OK;
+}
+
+voronoi_error voronoiRandomAnchors(voronoi_context *ctx, size_t anchors_size, point size) {
+    if(!ctx || anchors_size == 0 || size.x <= 0 || size.y <= 0) return VORONOI_EINVAL;
+
+    anchor *anchors = malloc(anchors_size * sizeof(anchor));
+    if(!anchors) return VORONOI_ENOMEM;
+
+    for(size_t idx = 0; idx < anchors_size; idx++) {
+        anchors[idx].pos.x = nextRandom(ctx) % size.x;
+        anchors[idx].pos.y = nextRandom(ctx) % size.y;
+        anchors[idx].col.red = nextRandom(ctx) % 255;
+        anchors[idx].col.green = nextRandom(ctx) % 255;
+        anchors[idx].col.blue = nextRandom(ctx) % 255;
+        anchors[idx].weight = 1;
+    }
+
+    free(ctx->anchors);
+    ctx->anchors = anchors;
+    ctx->anchors_size = anchors_size;
+    return VORONOI_OK;
+}
+
+const anchor *voronoiAnchors(const voronoi_context *ctx, size_t *anchors_size) {
+    if(!ctx) return NULL;
+
+    if(anchors_size) *anchors_size = ctx->anchors_size;
+    return ctx->anchors;
+}
+
+voronoi_error voronoiSetMetric(voronoi_context *ctx, distance_metric metric) {
+    if(!ctx || metric < METRIC_EUCLIDEAN || metric > METRIC_POWER) return VORONOI_EINVAL;
+
+    ctx->opts.metric = metric;
+    return VORONOI_OK;
+}
+
+/* `samples` of 0 or 1 turns anti-aliasing off, at most MAX_ANTIALIAS are allowed */
+voronoi_error voronoiSetAntialias(voronoi_context *ctx, long samples, sample_pattern pattern) {
+    if(!ctx || samples < 0 || samples > MAX_ANTIALIAS || (pattern != PATTERN_GRID && pattern != PATTERN_ROOKS)) {
+        return VORONOI_EINVAL;
+    }
+
+    ctx->opts.antialias = samples;
+    ctx->opts.pattern = pattern;
+    return VORONOI_OK;
+}
+
+voronoi_error voronoiRelax(voronoi_context *ctx, point size, long iterations, long threshold) {
+    if(!ctx || size.x <= 0 || size.y <= 0 || iterations < 0 || threshold < 0) return VORONOI_EINVAL;
+    if(!validAnchors(ctx)) return VORONOI_EINVAL;
+
+    if(relaxAnchors(ctx->anchors, ctx->anchors_size, size, iterations, threshold, &ctx->opts) == 0) {
+        return VORONOI_ERENDER;
+    }
+
+    return VORONOI_OK;
+}
+
+/*
+    Stores in `nearest` the index of the anchor closest to each of the
+    `count` points, given as x, y pairs.
+*/
+voronoi_error voronoiQuery(voronoi_context *ctx, const double *points, size_t count, size_t *nearest) {
+    if(!ctx || (count > 0 && (!points || !nearest))) return VORONOI_EINVAL;
+    if(!validAnchors(ctx)) return VORONOI_EINVAL;
+
+    if(queryAnchors(ctx->anchors, ctx->anchors_size, points, count, nearest, &ctx->opts) == 0) {
+        return VORONOI_ERENDER;
+    }
+
+    return VORONOI_OK;
+}
+
+/*
+    Renders into `buffer`, which holds `size.y` rows that are `stride` bytes
+    apart, both need to be multiples of 4 for PIXEL_INDEX. The buffer is
+    written in place, nothing is allocated per pixel.
+*/
+voronoi_error voronoiRender(voronoi_context *ctx, uint8_t *buffer, point size, size_t stride, pixel_format format) {
+    if(!ctx || !buffer || size.x <= 0 || size.y <= 0) return VORONOI_EINVAL;
+    if(format != PIXEL_RGB && format != PIXEL_BGR && format != PIXEL_INDEX) return VORONOI_EINVAL;
+
+    size_t row = size.x * (format == PIXEL_INDEX ? sizeof(uint32_t) : sizeof(color));
+    if(stride < row) return VORONOI_EINVAL;
+
+    /* Anchor indices are stored as aligned uint32_t */
+    if(format == PIXEL_INDEX && ((uintptr_t)buffer % sizeof(uint32_t) != 0 || stride % sizeof(uint32_t) != 0)) {
+        return VORONOI_EINVAL;
+    }
+
+    if(!validAnchors(ctx)) return VORONOI_EINVAL;
+
+    framebuffer fb = {
+        .data = buffer,
+        .size = size,
+        .stride = stride,
+        .format = format
+    };
+
+    if(generateVoronoi(&fb, ctx->anchors, ctx->anchors_size, &ctx->opts) == 0) {
+        return VORONOI_ERENDER;
+    }
+
+    return VORONOI_OK;
+}
@@ -0,0 +1,47 @@
+#ifndef VORONOI_LIBVORONOI_H
+#define VORONOI_LIBVORONOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./types.h"
+
+/* The library is built with hidden visibility, only these are exported */
+#if defined(__GNUC__)
+#define VORONOI_API __attribute__((visibility("default")))
+#else
+#define VORONOI_API
+#endif
+
+/*
+    Library interface for rendering into caller owned buffers. Every
+    context owns its anchors, options, random state and thread pool, so
+    separate contexts can be used from separate threads at the same time,
+    while one context must only be used by one thread at a time.
+*/
+typedef struct voronoi_context voronoi_context;
+
+typedef enum voronoi_error {
+    VORONOI_OK = 0,
+    VORONOI_ENOMEM,
+    VORONOI_EINVAL,
+    VORONOI_ETHREAD,
+    VORONOI_ERENDER
+} voronoi_error;
+
+VORONOI_API voronoi_context *voronoiCreate(long, voronoi_error *);
+VORONOI_API void voronoiDestroy(voronoi_context *);
+VORONOI_API const char *voronoiError(voronoi_error);
+
+VORONOI_API voronoi_error voronoiSeed(voronoi_context *, unsigned long);
+VORONOI_API voronoi_error voronoiSetAnchors(voronoi_context *, const anchor *, size_t);
+VORONOI_API voronoi_error voronoiRandomAnchors(voronoi_context *, size_t, point);
+VORONOI_API const anchor *voronoiAnchors(const voronoi_context *, size_t *);
+
+VORONOI_API voronoi_error voronoiSetMetric(voronoi_context *, distance_metric);
+VORONOI_API voronoi_error voronoiSetAntialias(voronoi_context *, long, sample_pattern);
+VORONOI_API voronoi_error voronoiRelax(voronoi_context *, point, long, long);
+
+VORONOI_API voronoi_error voronoiQuery(voronoi_context *, const double *, size_t, size_t *);
+VORONOI_API voronoi_error voronoiRender(voronoi_context *, uint8_t *, point, size_t, pixel_format);
+
+#endif
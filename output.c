@@ -0,0 +1,295 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "./output.h"
+#include <png.h>
+#include <wand/MagickWand.h>
+
+#define BMP_HEADER_SIZE 54
+
+static const struct {
+    const char *name;
+    output_format format;
+} format_names[] = {
+    {"png", FORMAT_PNG},
+    {"gif", FORMAT_GIF},
+    {"ppm", FORMAT_PPM},
+    {"bmp", FORMAT_BMP},
+    {"raw", FORMAT_RAW},
+    {"index", FORMAT_INDEX},
+    {"svg", FORMAT_SVG},
+    {"geojson", FORMAT_GEOJSON},
+};
+
+static const size_t format_names_size = sizeof(format_names) / sizeof(format_names[0]);
+
+static void putLE16(uint8_t *dst, uint16_t value) {
+    dst[0] = value & 0xff;
+    dst[1] = value >> 8;
+}
+
+static void putLE32(uint8_t *dst, uint32_t value) {
+    dst[0] = value & 0xff;
+    dst[1] = (value >> 8) & 0xff;
+    dst[2] = (value >> 16) & 0xff;
+    dst[3] = value >> 24;
+}
+
+output_format formatFromName(const char *name) {
+    for(size_t idx = 0; idx < format_names_size; idx++) {
+        if(strcasecmp(name, format_names[idx].name) == 0) {
+            return format_names[idx].format;
+        }
+    }
+
+    return FORMAT_NONE;
+}
+
+output_format formatFromFilename(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    if(!ext || strchr(ext, '/')) return FORMAT_NONE;
+    return formatFromName(ext + 1);
+}
+
+bool isMappedFormat(output_format format) {
+    return format == FORMAT_PPM || format == FORMAT_BMP ||
+        format == FORMAT_RAW || format == FORMAT_INDEX;
+}
+
+bool isVectorFormat(output_format format) {
+    return format == FORMAT_SVG || format == FORMAT_GEOJSON;
+}
+
+int mapOutput(const char *filename, output_format format, point size, mapped_output *out) {
+    char header[BMP_HEADER_SIZE];
+    size_t header_size = 0;
+
+    out->fd = -1;
+    out->base = MAP_FAILED;
+    out->fb.size = size;
+    out->fb.first_row = 0;
+
+    switch(format) {
+        case FORMAT_PPM:
+            header_size = snprintf(header, sizeof(header), "P6\n%ld %ld\n255\n", size.x, size.y);
+            out->fb.stride = size.x * 3;
+            out->fb.format = PIXEL_RGB;
+            break;
+
+        case FORMAT_BMP: {
+            uint8_t *h = (uint8_t*)header;
+            out->fb.stride = (size.x * 3 + 3) & ~3L;
+            out->fb.format = PIXEL_BGR;
+
+            size_t image_size = out->fb.stride * size.y;
+            if(image_size + BMP_HEADER_SIZE > UINT32_MAX || size.x > INT32_MAX || size.y > INT32_MAX) {
+                warnx("Image is too large for a BMP file");
+                return 0;
+            }
+
+            /* A negative height stores the rows top-down, the same order they are rendered in */
+            memset(header, 0, sizeof(header));
+            h[0] = 'B';
+            h[1] = 'M';
+            putLE32(h + 2, image_size + BMP_HEADER_SIZE);
+            putLE32(h + 10, BMP_HEADER_SIZE);
+            putLE32(h + 14, 40);
+            putLE32(h + 18, size.x);
+            putLE32(h + 22, -(int32_t)size.y);
+            putLE16(h + 26, 1);
+            putLE16(h + 28, 24);
+            putLE32(h + 34, image_size);
+            header_size = BMP_HEADER_SIZE;
+            break;
+        }
+
+        case FORMAT_RAW:
+            out->fb.stride = size.x * 3;
+            out->fb.format = PIXEL_RGB;
+            break;
+
+        case FORMAT_INDEX:
+            out->fb.stride = size.x * sizeof(uint32_t);
+            out->fb.format = PIXEL_INDEX;
+            break;
+
+        default:
+            warnx("Format can not be mapped");
+            return 0;
+    }
+
+    out->length = header_size + out->fb.stride * size.y;
+
+    out->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(out->fd == -1) {
+        warn("Failed to open %s", filename);
+        return 0;
+    }
+
+    if(ftruncate(out->fd, out->length) == -1) {
+        warn("Failed to resize %s to %zu bytes", filename, out->length);
+        close(out->fd);
+        return 0;
+    }
+
+    out->base = mmap(NULL, out->length, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+    if(out->base == MAP_FAILED) {
+        warn("mmap()");
+        close(out->fd);
+        return 0;
+    }
+
+    memcpy(out->base, header, header_size);
+    out->fb.data = out->base + header_size;
+    return 1;
+}
+
+int unmapOutput(mapped_output *out) {
+    int ret = 1;
+
+    if(munmap(out->base, out->length) == -1) {
+        warn("munmap()");
+        ret = 0;
+    }
+
+    if(close(out->fd) == -1) {
+        warn("close()");
+        ret = 0;
+    }
+
+    return ret;
+}
+
+int generatePNG(const char *filename, const color *color_map, point size) {
+    FILE *fp;
+    png_structp pngp = NULL;
+    png_infop infop = NULL;
+    png_byte **rows = NULL;
+    int pixel_size =3;
+    int depth = 8;
+
+    fp = fopen(filename, "wb+");
+    if(!fp) {
+        warn("Failed to open %s", filename);
+        return 0;
+    }
+
+    pngp = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if(pngp == NULL) {
+        warnx("png_create_write_struct()");
+        return 0;
+    }
+
+    infop = png_create_info_struct(pngp);
+
+    if(infop == NULL) {
+        warnx("Failed call to png_create_info_struct()");
+        return 0;
+    }
+
+    png_set_IHDR(pngp, infop, size.x, size.y, depth,
+            PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
+            );
+
+    rows = png_malloc(pngp, size.y * sizeof(png_byte *));
+    for(long r = 0; r < size.y; r++) {
+        png_byte *row = png_malloc(pngp, size.x * pixel_size);
+        rows[r] = row;
+        for(long c = 0; c < size.x; c++) {
+            color col = color_map[c + r * size.x];
+            *row++ = col.red;
+            *row++ = col.green;
+            *row++ = col.blue;
+        }
+    }
+
+    png_init_io(pngp, fp);
+    png_set_rows(pngp, infop, rows);
+    png_write_png(pngp, infop, PNG_TRANSFORM_IDENTITY, NULL);
+
+    for(long r = 0; r < size.y; r++) {
+        png_free(pngp, rows[r]);
+    }
+
+    png_free(pngp, rows);
+    png_destroy_write_struct(&pngp, &infop);
+    fclose(fp);
+    return 1;
+}
+
+int generateGIF(const char *filename, anchor *anchors, size_t anchors_size, color *color_map, point size, size_t frames, int velocity, bool keep, const render_options *opts) {
+    MagickWandGenesis();
+    MagickWand *wand = NewMagickWand();
+    MagickBooleanType status;
+    /*MagickSetCompression(wand, BZipCompression);*/
+
+    point direction[] = {
+        {-1, 0}, {-1, 1}, {0, 1}, {1, 1},
+        {1, 0}, {1, -1}, {0, -1}, {-1, -1}
+    };
+
+    static const size_t direction_size = sizeof(direction) / sizeof(direction[0]);
+
+    framebuffer fb = {
+        .data = (uint8_t*)color_map,
+        .size = size,
+        .stride = size.x * sizeof(color),
+        .format = PIXEL_RGB
+    };
+
+    char filepath[PATH_MAX];
+    for(size_t frame = 1; frame <= frames; frame++) {
+        sprintf(filepath, "frame_%zu.png", frame);
+
+        for(size_t idx = 0; idx < anchors_size; idx++) {
+            size_t dir = random() % direction_size;
+            point step = direction[dir];
+            anchors[idx].pos.x += step.x * velocity;
+            anchors[idx].pos.y += step.y * velocity;
+        }
+
+        if(generateVoronoi(&fb, anchors, anchors_size, opts) == 0) {
+            warnx("Failed to generate diagram");
+            return 0;
+        }
+
+        if(generatePNG(filepath, color_map, size) == 0) {
+            warnx("Failed to generate PNG image");
+            return 0;
+        }
+
+        MagickReadImage(wand, filepath);
+    }
+
+    status = MagickWriteImages(wand, filename, MagickTrue);
+
+    if(status == MagickFalse) {
+        ExceptionType severity;
+        char *description = MagickGetException(wand,&severity);
+        (void) warnx("%s %s %lu %s\n",GetMagickModule(),description);
+        description= (char *) MagickRelinquishMemory(description);
+        return 0;
+    }
+
+    if(!keep) {
+        for(size_t frame = 1; frame <= frames; frame++) {
+            sprintf(filepath, "frame_%zu.png", frame);
+            remove(filepath);
+        }
+    }
+
+    wand = DestroyMagickWand(wand);
+    MagickWandTerminus();
+    return 1;
+}
@@ -0,0 +1,41 @@
+#ifndef VORONOI_OUTPUT_H
+#define VORONOI_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "./canvas.h"
+
+typedef enum output_format {
+    FORMAT_NONE = 0,
+    FORMAT_PNG,
+    FORMAT_GIF,
+    FORMAT_PPM,
+    FORMAT_BMP,
+    FORMAT_RAW,
+    FORMAT_INDEX,
+    FORMAT_SVG,
+    FORMAT_GEOJSON
+} output_format;
+
+/*
+    An output file that has been truncated to its final size and mapped
+    shared, `fb` points past the header so the render workers write pixels
+    straight into the page cache.
+*/
+typedef struct mapped_output {
+    int fd;
+    uint8_t *base;
+    size_t length;
+    framebuffer fb;
+} mapped_output;
+
+output_format formatFromName(const char *);
+output_format formatFromFilename(const char *);
+bool isMappedFormat(output_format);
+bool isVectorFormat(output_format);
+int mapOutput(const char *, output_format, point, mapped_output *);
+int unmapOutput(mapped_output *);
+int generatePNG(const char *, const color *, point);
+int generateGIF(const char *, anchor *, size_t, color *, point, size_t, int, bool, const render_options *);
+
+#endif
@@ -0,0 +1,187 @@
+#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <err.h>
+
+#include "./pool.h"
+
+typedef struct worker {
+    thread_pool *pool;
+    long index;
+} worker;
+
+/*
+    A fixed set of threads that run the tasks of one job at a time. Task t
+    always goes to worker t % size, so with pinned workers a chunk of the
+    framebuffer keeps being rendered by the same processor from frame to
+    frame and stays in its local memory.
+*/
+struct thread_pool {
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t *threads;
+    worker *workers;
+    long size;
+    unsigned long generation;
+    long pending;
+    bool stop;
+    void *(*fn)(void *);
+    void **args;
+    long count;
+};
+
+static void *poolWorker(void *arg) {
+    worker *w = arg;
+    thread_pool *pool = w->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for(;;) {
+        while(pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+
+        if(pool->stop) break;
+
+        seen = pool->generation;
+        void *(*fn)(void *) = pool->fn;
+        void **args = pool->args;
+        long count = pool->count;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        for(long t = w->index; t < count; t += pool->size) {
+            fn(args[t]);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0) pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int nthCPU(long n) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if(sched_getaffinity(0, sizeof(set), &set) == -1) return -1;
+
+    long count = CPU_COUNT(&set);
+    if(count == 0) return -1;
+    n %= count;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &set) && n-- == 0) return cpu;
+    }
+
+    return -1;
+}
+
+/* `threads` of 0 starts one thread per processor */
+thread_pool *poolCreate(long threads, bool pin) {
+    if(threads <= 0) threads = sysconf(_SC_NPROCESSORS_CONF);
+    if(threads <= 0) threads = 1;
+
+    thread_pool *pool = calloc(1, sizeof(thread_pool));
+    if(!pool) return NULL;
+
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    pool->workers = calloc(threads, sizeof(worker));
+
+    if(!pool->threads || !pool->workers) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    for(long t = 0; t < threads; t++) {
+        pool->workers[t] = (worker){pool, t};
+
+        if(pin) {
+            int cpu = nthCPU(t);
+
+            if(cpu != -1) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+            }
+        }
+
+        if(pthread_create(&pool->threads[t], &attr, poolWorker, &pool->workers[t]) != 0) {
+            pthread_attr_destroy(&attr);
+            pool->size = t;
+            poolDestroy(pool);
+            return NULL;
+        }
+
+        pool->size = t + 1;
+    }
+
+    pthread_attr_destroy(&attr);
+    return pool;
+}
+
+long poolSize(const thread_pool *pool) {
+    return pool->size;
+}
+
+/* Runs fn on every one of the `count` arguments and waits until all are done */
+int poolRun(thread_pool *pool, void *(*fn)(void *), void **args, long count) {
+    pthread_mutex_lock(&pool->run_lock);
+    pthread_mutex_lock(&pool->lock);
+
+    pool->fn = fn;
+    pool->args = args;
+    pool->count = count;
+    pool->pending = pool->size;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+
+    while(pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+    return 1;
+}
+
+void poolDestroy(thread_pool *pool) {
+    if(!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(long t = 0; t < pool->size; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,13 @@
+#ifndef VORONOI_POOL_H
+#define VORONOI_POOL_H
+
+#include <stdbool.h>
+
+typedef struct thread_pool thread_pool;
+
+thread_pool *poolCreate(long, bool);
+long poolSize(const thread_pool *);
+int poolRun(thread_pool *, void *(*)(void *), void **, long);
+void poolDestroy(thread_pool *);
+
+#endif
@@ -0,0 +1,785 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <err.h>
+
+#include "./shard.h"
+#include "./pool.h"
+
+#define TILES_PER_WORKER 8
+#define MIN_TILE_PIXELS 4096
+#define SLOW_FACTOR 4
+#define MIN_SLOW_SECONDS 0.1
+#define POLL_INTERVAL_MS 50
+#define IO_TIMEOUT_SECONDS 30
+
+/* Largest values a worker accepts in a job, beyond them the scores could overflow */
+#define MAX_JOB_SIDE (1L << 24)
+#define MAX_JOB_ANCHORS (1L << 24)
+#define MAX_JOB_COORD (1L << 29)
+#define MAX_JOB_WEIGHT (1L << 40)
+
+/*
+    Every message starts with four little endian 64 bit words, the type
+    and three arguments.
+
+    MSG_JOB     width, height, anchors, followed by the metric, samples,
+                sample pattern and pixel format and then x, y, weight and
+                color of every anchor
+    MSG_TILE    tile, start, run
+    MSG_RESULT  tile, start, run, followed by the pixels of the tile
+    MSG_ERROR   tile
+
+    A worker renders the tiles of the last job it was sent until the
+    connection is closed. Jobs are checked against the MAX_JOB limits but
+    peers are not authenticated, so a worker must only listen where every
+    peer is trusted.
+*/
+enum {
+    MSG_JOB = 1,
+    MSG_TILE,
+    MSG_RESULT,
+    MSG_ERROR
+};
+
+#define HEADER_WORDS 4
+#define JOB_WORDS 4
+#define ANCHOR_WORDS 4
+
+typedef enum tile_state {
+    TILE_PENDING = 0,
+    TILE_RUNNING,
+    TILE_DONE
+} tile_state;
+
+typedef struct tile {
+    long start;
+    long run;
+    tile_state state;
+    int copies;
+} tile;
+
+typedef struct worker_state {
+    long tile;
+    struct timespec sent;
+    long done;
+    bool alive;
+} worker_state;
+
+static void putWord(uint8_t *buf, uint64_t value) {
+    for(int byte = 0; byte < 8; byte++) buf[byte] = value >> (8 * byte);
+}
+
+static uint64_t getWord(const uint8_t *buf) {
+    uint64_t value = 0;
+    for(int byte = 0; byte < 8; byte++) value |= (uint64_t)buf[byte] << (8 * byte);
+    return value;
+}
+
+/* MSG_NOSIGNAL keeps a closed peer from killing the process with SIGPIPE */
+static bool sendAll(int fd, const void *buf, size_t size) {
+    const uint8_t *pos = buf;
+
+    while(size > 0) {
+        ssize_t put = send(fd, pos, size, MSG_NOSIGNAL);
+        if(put < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+
+        pos += put;
+        size -= put;
+    }
+
+    return true;
+}
+
+static bool recvAll(int fd, void *buf, size_t size) {
+    uint8_t *pos = buf;
+
+    while(size > 0) {
+        ssize_t got = recv(fd, pos, size, 0);
+        if(got <= 0) {
+            if(got < 0 && errno == EINTR) continue;
+            return false;
+        }
+
+        pos += got;
+        size -= got;
+    }
+
+    return true;
+}
+
+static bool sendHeader(int fd, uint64_t type, uint64_t a, uint64_t b, uint64_t c) {
+    uint8_t buf[HEADER_WORDS * 8];
+
+    putWord(buf, type);
+    putWord(buf + 8, a);
+    putWord(buf + 16, b);
+    putWord(buf + 24, c);
+    return sendAll(fd, buf, sizeof(buf));
+}
+
+static bool recvWords(int fd, uint64_t *words, size_t count) {
+    uint8_t buf[HEADER_WORDS * 8];
+
+    for(size_t idx = 0; idx < count; idx += HEADER_WORDS) {
+        size_t chunk = count - idx < HEADER_WORDS ? count - idx : HEADER_WORDS;
+        if(!recvAll(fd, buf, chunk * 8)) return false;
+
+        for(size_t word = 0; word < chunk; word++) words[idx + word] = getWord(buf + 8 * word);
+    }
+
+    return true;
+}
+
+static double secondsSince(const struct timespec *begin) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - begin->tv_sec) + (now.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+    A worker that stops halfway through a message would otherwise block
+    the coordinator forever.
+*/
+static void setTimeouts(int fd) {
+    struct timeval timeout = { .tv_sec = IO_TIMEOUT_SECONDS };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+    Addresses are either unix:<PATH> or <HOST>:<PORT>, an empty host
+    listens on every interface.
+*/
+static int openSocket(const char *addr, bool listening) {
+    if(strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+        const char *path = addr + 5;
+
+        if(strlen(path) >= sizeof(sun.sun_path)) {
+            warnx("Socket path too long: %s", path);
+            return -1;
+        }
+
+        strcpy(sun.sun_path, path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd == -1) {
+            warn("socket()");
+            return -1;
+        }
+
+        if(listening) unlink(path);
+
+        int ret = listening
+            ? bind(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0 && listen(fd, SOMAXCONN) == 0
+            : connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0;
+
+        if(!ret) {
+            warn("Failed to %s %s", listening ? "listen on" : "connect to", addr);
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    const char *colon = strrchr(addr, ':');
+    if(!colon) {
+        warnx("Invalid address %s", addr);
+        return -1;
+    }
+
+    char host[NI_MAXHOST];
+    size_t host_size = colon - addr;
+
+    if(host_size >= sizeof(host)) {
+        warnx("Invalid address %s", addr);
+        return -1;
+    }
+
+    memcpy(host, addr, host_size);
+    host[host_size] = '\0';
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0
+    };
+
+    struct addrinfo *res;
+    int status = getaddrinfo(host_size ? host : NULL, colon + 1, &hints, &res);
+
+    if(status != 0) {
+        warnx("Failed to resolve %s: %s", addr, gai_strerror(status));
+        return -1;
+    }
+
+    int fd = -1;
+
+    for(struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd == -1) continue;
+
+        int one = 1;
+        bool ok;
+
+        if(listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0;
+        } else {
+            ok = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            if(ok) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        if(ok) break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    if(fd == -1) warn("Failed to %s %s", listening ? "listen on" : "connect to", addr);
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool inRange(long value, long limit) {
+    return value >= -limit && value <= limit;
+}
+
+static bool readJob(int fd, const uint64_t *head, framebuffer *fb, anchor **anchors, size_t *anchors_size, render_options *opts) {
+    uint64_t params[JOB_WORDS];
+    uint64_t width = head[1], height = head[2], count = head[3];
+
+    if(width == 0 || width > MAX_JOB_SIDE || height == 0 || height > MAX_JOB_SIDE) return false;
+    if(count == 0 || count > MAX_JOB_ANCHORS) return false;
+
+    if(!recvWords(fd, params, JOB_WORDS)) return false;
+    if(params[0] > METRIC_POWER || params[1] > MAX_ANTIALIAS || params[2] > PATTERN_ROOKS || params[3] > PIXEL_INDEX) {
+        return false;
+    }
+
+    anchor *list = malloc(count * sizeof(anchor));
+    if(!list) {
+        warn("Failed to allocate %zu bytes", (size_t)count * sizeof(anchor));
+        return false;
+    }
+
+    for(size_t idx = 0; idx < count; idx++) {
+        uint64_t words[ANCHOR_WORDS];
+
+        if(!recvWords(fd, words, ANCHOR_WORDS)) {
+            free(list);
+            return false;
+        }
+
+        list[idx].pos.x = (int64_t)words[0];
+        list[idx].pos.y = (int64_t)words[1];
+        list[idx].weight = (int64_t)words[2];
+        list[idx].col = (color){ words[3] >> 16, words[3] >> 8, words[3] };
+
+        bool valid = inRange(list[idx].pos.x, MAX_JOB_COORD) && inRange(list[idx].pos.y, MAX_JOB_COORD)
+            && inRange(list[idx].weight, MAX_JOB_WEIGHT)
+            && (params[0] != METRIC_MULTIPLICATIVE || list[idx].weight > 0);
+
+        if(!valid) {
+            free(list);
+            return false;
+        }
+    }
+
+    free(*anchors);
+    *anchors = list;
+    *anchors_size = count;
+
+    opts->metric = params[0];
+    opts->antialias = params[1];
+    opts->pattern = params[2];
+
+    fb->size = (point){ width, height };
+    fb->format = params[3];
+    fb->stride = width * pixelSize(fb->format);
+    return true;
+}
+
+/* Serves the jobs sent over one connection until it is closed */
+static int serveConnection(int fd, const render_options *local) {
+    render_options opts = *local;
+    opts.verbose = false;
+    opts.pool = poolCreate(opts.threads, opts.pin);
+
+    if(!opts.pool) {
+        warnx("Failed to create threads");
+        return 0;
+    }
+
+    framebuffer fb = { .data = NULL };
+    anchor *anchors = NULL;
+    size_t anchors_size = 0;
+    uint8_t *buffer = NULL;
+    size_t buffer_size = 0;
+    int ret = 1;
+
+    for(;;) {
+        uint64_t head[HEADER_WORDS];
+        if(!recvWords(fd, head, HEADER_WORDS)) break;
+
+        if(head[0] == MSG_JOB) {
+            if(!readJob(fd, head, &fb, &anchors, &anchors_size, &opts)) {
+                warnx("Invalid job");
+                ret = 0;
+                break;
+            }
+
+            continue;
+        }
+
+        uint64_t id = head[1], start = head[2], run = head[3];
+        long area = fb.size.x * fb.size.y;
+
+        if(head[0] != MSG_TILE || !anchors || run == 0 || start >= (uint64_t)area || run > area - start) {
+            warnx("Invalid tile");
+            ret = 0;
+            break;
+        }
+
+        fb.first_row = start / fb.size.x;
+        long last_row = (start + run - 1) / fb.size.x;
+        size_t needed = (last_row - fb.first_row + 1) * fb.stride;
+
+        if(needed > buffer_size) {
+            uint8_t *grown = realloc(buffer, needed);
+            if(!grown) {
+                warn("Failed to allocate %zu bytes", needed);
+                if(!sendHeader(fd, MSG_ERROR, id, 0, 0)) break;
+                continue;
+            }
+
+            buffer = grown;
+            buffer_size = needed;
+        }
+
+        fb.data = buffer;
+
+        if(generateRange(&fb, start, run, anchors, anchors_size, &opts) == 0) {
+            if(!sendHeader(fd, MSG_ERROR, id, 0, 0)) break;
+            continue;
+        }
+
+        size_t psize = pixelSize(fb.format);
+        const uint8_t *pixels = buffer + (start % fb.size.x) * psize;
+
+        if(!sendHeader(fd, MSG_RESULT, id, start, run) || !sendAll(fd, pixels, run * psize)) break;
+    }
+
+    poolDestroy(opts.pool);
+    free(anchors);
+    free(buffer);
+    return ret;
+}
+
+/*
+    Forks `local` workers connected over socket pairs and connects to the
+    workers listening on `addrs`. An address that can not be reached is
+    kept as a dropped worker, so its tiles go to the others or are
+    rendered locally when none is left.
+*/
+int startWorkers(shard_workers *workers, long local, const char **addrs, size_t addrs_size, const render_options *opts) {
+    *workers = (shard_workers){ .fds = NULL };
+
+    size_t total = local + addrs_size;
+    workers->fds = malloc((total ? total : 1) * sizeof(int));
+    workers->pids = malloc((local ? local : 1) * sizeof(pid_t));
+
+    if(!workers->fds || !workers->pids) {
+        warn("Failed to allocate memory");
+        stopWorkers(workers);
+        return 0;
+    }
+
+    for(long idx = 0; idx < local; idx++) {
+        int sv[2];
+
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            warn("socketpair()");
+            stopWorkers(workers);
+            return 0;
+        }
+
+        fflush(NULL);
+        pid_t pid = fork();
+
+        if(pid == -1) {
+            warn("fork()");
+            close(sv[0]);
+            close(sv[1]);
+            stopWorkers(workers);
+            return 0;
+        }
+
+        if(pid == 0) {
+            for(size_t other = 0; other < workers->size; other++) close(workers->fds[other]);
+            close(sv[0]);
+            _exit(serveConnection(sv[1], opts) ? 0 : 1);
+        }
+
+        close(sv[1]);
+        setTimeouts(sv[0]);
+        workers->fds[workers->size++] = sv[0];
+        workers->pids[workers->pids_size++] = pid;
+    }
+
+    for(size_t idx = 0; idx < addrs_size; idx++) {
+        int fd = openSocket(addrs[idx], false);
+
+        if(fd == -1) {
+            warnx("Skipping worker %s", addrs[idx]);
+        } else {
+            setTimeouts(fd);
+        }
+
+        workers->fds[workers->size++] = fd;
+    }
+
+    return 1;
+}
+
+/*
+    Closing the connections tells the workers to exit. A forked worker
+    that was dropped may still be busy with its tile or stopped, and its
+    result is not wanted anymore, so every forked worker is killed rather
+    than waited for.
+*/
+void stopWorkers(shard_workers *workers) {
+    for(size_t idx = 0; idx < workers->size; idx++) {
+        if(workers->fds[idx] != -1) close(workers->fds[idx]);
+    }
+
+    for(size_t idx = 0; idx < workers->pids_size; idx++) {
+        kill(workers->pids[idx], SIGKILL);
+        while(waitpid(workers->pids[idx], NULL, 0) == -1 && errno == EINTR);
+    }
+
+    free(workers->fds);
+    free(workers->pids);
+    *workers = (shard_workers){ .fds = NULL };
+}
+
+static bool sendJob(int fd, const framebuffer *fb, const anchor *anchors, size_t anchors_size, const render_options *opts) {
+    size_t words = HEADER_WORDS + JOB_WORDS + ANCHOR_WORDS * anchors_size;
+    uint8_t *buf = malloc(words * 8);
+
+    if(!buf) {
+        warn("Failed to allocate %zu bytes", words * 8);
+        return false;
+    }
+
+    uint8_t *pos = buf;
+    uint64_t head[] = {
+        MSG_JOB, fb->size.x, fb->size.y, anchors_size,
+        opts->metric, opts->antialias, opts->pattern, fb->format
+    };
+
+    for(size_t idx = 0; idx < HEADER_WORDS + JOB_WORDS; idx++, pos += 8) putWord(pos, head[idx]);
+
+    for(size_t idx = 0; idx < anchors_size; idx++) {
+        const anchor *a = &anchors[idx];
+
+        putWord(pos, a->pos.x);
+        putWord(pos + 8, a->pos.y);
+        putWord(pos + 16, a->weight);
+        putWord(pos + 24, (uint64_t)a->col.red << 16 | a->col.green << 8 | a->col.blue);
+        pos += 8 * ANCHOR_WORDS;
+    }
+
+    bool ok = sendAll(fd, buf, words * 8);
+    free(buf);
+    return ok;
+}
+
+/* Reads the pixels of a tile straight into the rows of the framebuffer */
+static bool recvPixels(int fd, const framebuffer *fb, long start, long run) {
+    size_t psize = pixelSize(fb->format);
+
+    for(long pos = start; pos < start + run;) {
+        point p = { pos % fb->size.x, pos / fb->size.x };
+        long count = fb->size.x - p.x;
+        if(count > start + run - pos) count = start + run - pos;
+
+        uint8_t *row = fb->data + (p.y - fb->first_row) * fb->stride + p.x * psize;
+        if(!recvAll(fd, row, count * psize)) return false;
+
+        pos += count;
+    }
+
+    return true;
+}
+
+/* Reads and drops the pixels of a late copy of a tile that is already done */
+static bool discardPixels(int fd, size_t size) {
+    uint8_t buf[4096];
+
+    while(size > 0) {
+        size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+        if(!recvAll(fd, buf, chunk)) return false;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+static void dropWorker(shard_workers *workers, worker_state *states, tile *tiles, size_t idx) {
+    worker_state *w = &states[idx];
+
+    if(w->tile >= 0) {
+        tile *t = &tiles[w->tile];
+        if(--t->copies == 0 && t->state != TILE_DONE) t->state = TILE_PENDING;
+    }
+
+    close(workers->fds[idx]);
+    workers->fds[idx] = -1;
+    w->alive = false;
+    w->tile = -1;
+}
+
+/* The next pending tile, or a second copy of the one that has run the longest if it is too slow */
+static long nextTile(tile *tiles, long tiles_size, const worker_state *states, size_t states_size, double average) {
+    for(long idx = 0; idx < tiles_size; idx++) {
+        if(tiles[idx].state == TILE_PENDING) return idx;
+    }
+
+    if(average == 0) return -1;
+
+    double limit = SLOW_FACTOR * average;
+    if(limit < MIN_SLOW_SECONDS) limit = MIN_SLOW_SECONDS;
+
+    long slowest = -1;
+    double oldest = limit;
+
+    for(size_t idx = 0; idx < states_size; idx++) {
+        const worker_state *w = &states[idx];
+        /* A tile that is done or already has a second copy is left alone */
+        if(!w->alive || w->tile < 0 || tiles[w->tile].state != TILE_RUNNING || tiles[w->tile].copies > 1) continue;
+
+        double age = secondsSince(&w->sent);
+        if(age > oldest) {
+            oldest = age;
+            slowest = w->tile;
+        }
+    }
+
+    return slowest;
+}
+
+/*
+    Splits the image into tiles of consecutive pixels and hands them out
+    to the workers one at a time, so faster workers end up rendering more
+    of them. Tiles of a worker that fails go back to the queue, a tile that
+    runs much longer than the average is given to an idle worker as well
+    and the first result wins. Whatever is left when no worker remains is
+    rendered locally.
+*/
+int generateSharded(shard_workers *workers, const framebuffer *fb, const anchor *anchors, size_t anchors_size, const render_options *opts) {
+    long area = fb->size.x * fb->size.y;
+    long tile_run = area / (TILES_PER_WORKER * (long)(workers->size ? workers->size : 1));
+    if(tile_run < MIN_TILE_PIXELS) tile_run = MIN_TILE_PIXELS;
+
+    long tiles_size = (area + tile_run - 1) / tile_run;
+    tile *tiles = calloc(tiles_size, sizeof(tile));
+    worker_state *states = calloc(workers->size ? workers->size : 1, sizeof(worker_state));
+    struct pollfd *fds = calloc(workers->size ? workers->size : 1, sizeof(struct pollfd));
+    size_t *polled = calloc(workers->size ? workers->size : 1, sizeof(size_t));
+
+    if(!tiles || !states || !fds || !polled) {
+        warn("Failed to allocate memory");
+        free(tiles);
+        free(states);
+        free(fds);
+        free(polled);
+        return 0;
+    }
+
+    for(long idx = 0; idx < tiles_size; idx++) {
+        tiles[idx].start = idx * tile_run;
+        tiles[idx].run = idx + 1 == tiles_size ? area - tiles[idx].start : tile_run;
+    }
+
+    for(size_t idx = 0; idx < workers->size; idx++) {
+        states[idx].tile = -1;
+        states[idx].alive = workers->fds[idx] != -1 && sendJob(workers->fds[idx], fb, anchors, anchors_size, opts);
+        if(!states[idx].alive && workers->fds[idx] != -1) dropWorker(workers, states, tiles, idx);
+    }
+
+    long done = 0;
+    long reassigned = 0;
+    double total_seconds = 0;
+
+    while(done < tiles_size) {
+        double average = done ? total_seconds / done : 0;
+        size_t alive = 0;
+
+        for(size_t idx = 0; idx < workers->size; idx++) {
+            worker_state *w = &states[idx];
+            if(!w->alive) continue;
+
+            if(w->tile < 0) {
+                long next = nextTile(tiles, tiles_size, states, workers->size, average);
+
+                if(next >= 0) {
+                    tile *t = &tiles[next];
+                    if(t->state == TILE_RUNNING) reassigned++;
+
+                    w->tile = next;
+                    if(t->state == TILE_PENDING) t->state = TILE_RUNNING;
+                    t->copies++;
+                    clock_gettime(CLOCK_MONOTONIC, &w->sent);
+
+                    if(!sendHeader(workers->fds[idx], MSG_TILE, next, t->start, t->run)) {
+                        warnx("Lost worker %zu", idx);
+                        dropWorker(workers, states, tiles, idx);
+                        continue;
+                    }
+                }
+            }
+
+            if(w->tile >= 0) {
+                fds[alive] = (struct pollfd){ .fd = workers->fds[idx], .events = POLLIN };
+                polled[alive++] = idx;
+            }
+        }
+
+        /* Either no worker is left or every tile is done */
+        if(alive == 0) break;
+
+        if(poll(fds, alive, POLL_INTERVAL_MS) == -1) {
+            if(errno == EINTR) continue;
+            warn("poll()");
+            break;
+        }
+
+        for(size_t idx = 0; idx < alive; idx++) {
+            if(fds[idx].revents == 0) continue;
+
+            size_t widx = polled[idx];
+            worker_state *w = &states[widx];
+            tile *t = &tiles[w->tile];
+            uint64_t head[HEADER_WORDS];
+
+            bool ok = recvWords(fds[idx].fd, head, HEADER_WORDS)
+                && head[0] == MSG_RESULT
+                && head[1] == (uint64_t)w->tile
+                && head[2] == (uint64_t)t->start
+                && head[3] == (uint64_t)t->run
+                && (t->state == TILE_DONE
+                    ? discardPixels(fds[idx].fd, t->run * pixelSize(fb->format))
+                    : recvPixels(fds[idx].fd, fb, t->start, t->run));
+
+            if(!ok) {
+                warnx("Lost worker %zu", widx);
+                dropWorker(workers, states, tiles, widx);
+                continue;
+            }
+
+            if(t->state != TILE_DONE) {
+                t->state = TILE_DONE;
+                total_seconds += secondsSince(&w->sent);
+                done++;
+            }
+
+            t->copies--;
+            w->tile = -1;
+            w->done++;
+        }
+    }
+
+    if(done < tiles_size) {
+        warnx("No workers left, rendering %ld tiles locally", tiles_size - done);
+
+        for(long idx = 0; idx < tiles_size; idx++) {
+            if(tiles[idx].state == TILE_DONE) continue;
+
+            if(generateRange(fb, tiles[idx].start, tiles[idx].run, anchors, anchors_size, opts) == 0) {
+                free(tiles);
+                free(states);
+                free(fds);
+                free(polled);
+                return 0;
+            }
+        }
+    }
+
+    /* A worker still busy with a duplicate tile is too slow to keep */
+    for(size_t idx = 0; idx < workers->size; idx++) {
+        if(states[idx].alive && states[idx].tile >= 0) dropWorker(workers, states, tiles, idx);
+    }
+
+    if(opts->verbose) {
+        for(size_t idx = 0; idx < workers->size; idx++) {
+            fprintf(stderr, "worker %zu: %ld tiles%s\n", idx, states[idx].done, states[idx].alive ? "" : ", dropped");
+        }
+
+        fprintf(stderr, "%ld tiles of %ld pixels, %ld reassigned\n", tiles_size, tile_run, reassigned);
+    }
+
+    free(tiles);
+    free(states);
+    free(fds);
+    free(polled);
+    return 1;
+}
+
+/* Runs as a worker, every connection is served by its own process */
+int serveWorkers(const char *addr, const render_options *opts) {
+    int fd = openSocket(addr, true);
+    if(fd == -1) return 0;
+
+    /* Reaps the connection processes */
+    signal(SIGCHLD, SIG_IGN);
+
+    if(opts->verbose) fprintf(stderr, "Serving on %s\n", addr);
+
+    for(;;) {
+        int conn = accept(fd, NULL, NULL);
+
+        if(conn == -1) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            warn("accept()");
+            close(fd);
+            return 0;
+        }
+
+        int one = 1;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        pid_t pid = fork();
+
+        if(pid == -1) {
+            warn("fork()");
+        } else if(pid == 0) {
+            close(fd);
+            _exit(serveConnection(conn, opts) ? 0 : 1);
+        }
+
+        close(conn);
+    }
+}
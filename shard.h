@@ -0,0 +1,25 @@
+#ifndef VORONOI_SHARD_H
+#define VORONOI_SHARD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "./canvas.h"
+
+/*
+    Render workers reached over sockets, either processes forked on this
+    machine or `voronoi --serve` instances connected to by address.
+    `pids` holds the forked ones so they can be reaped.
+*/
+typedef struct shard_workers {
+    int *fds;
+    size_t size;
+    pid_t *pids;
+    size_t pids_size;
+} shard_workers;
+
+int startWorkers(shard_workers *, long, const char **, size_t, const render_options *);
+void stopWorkers(shard_workers *);
+int generateSharded(shard_workers *, const framebuffer *, const anchor *, size_t, const render_options *);
+int serveWorkers(const char *, const render_options *);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef VORONOI_TYPES_H
+#define VORONOI_TYPES_H
+
+#include <stdint.h>
+
+/* Types shared by the renderer and the public library interface */
+
+typedef struct point {
+    long x;
+    long y;
+} point;
+
+typedef struct color {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} color;
+
+typedef struct anchor {
+    point pos;
+    color col;
+    long weight;
+} anchor;
+
+typedef enum pixel_format {
+    PIXEL_RGB = 0,
+    PIXEL_BGR,
+    PIXEL_INDEX
+} pixel_format;
+
+typedef enum distance_metric {
+    METRIC_EUCLIDEAN = 0,
+    METRIC_MANHATTAN,
+    METRIC_CHEBYSHEV,
+    METRIC_ADDITIVE,
+    METRIC_MULTIPLICATIVE,
+    METRIC_POWER
+} distance_metric;
+
+typedef enum sample_pattern {
+    PATTERN_GRID = 0,
+    PATTERN_ROOKS
+} sample_pattern;
+
+#define MAX_ANTIALIAS 16
+
+#endif
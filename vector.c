@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#include "./vector.h"
+
+#define STREAM_BUFFER_SIZE (1 << 20)
+#define LEAF_SIZE 8
+#define NEIGHBOR_WINDOW 8
+
+typedef struct vertex {
+    double x;
+    double y;
+} vertex;
+
+typedef struct polygon {
+    vertex *points;
+    size_t size;
+    size_t capacity;
+} polygon;
+
+typedef struct box {
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+} box;
+
+/*
+    A k-d tree over the anchors stored in place: the range [lo, hi) is a
+    node whose site is at mid = lo + (hi - lo) / 2, its left child is
+    [lo, mid) and its right child [mid + 1, hi). Every node splits its
+    longer side at the median, so the tree follows the anchors however
+    they are clustered. `boxes[mid]` bounds every site of the node,
+    `order` holds the anchor index of each site.
+*/
+typedef struct tree {
+    size_t size;
+    size_t *order;
+    vertex *sites;
+    box *boxes;
+} tree;
+
+/* Pixels are sampled at integer coordinates, so each site sits in the middle of its pixel */
+static vertex siteOf(const anchor *a) {
+    return (vertex){a->pos.x + 0.5, a->pos.y + 0.5};
+}
+
+static bool splitsVertically(const box *b) {
+    return b->max_y - b->min_y > b->max_x - b->min_x;
+}
+
+static double coordinate(vertex v, bool vertical) {
+    return vertical ? v.y : v.x;
+}
+
+static void swapSites(tree *t, size_t a, size_t b) {
+    vertex site = t->sites[a];
+    size_t idx = t->order[a];
+
+    t->sites[a] = t->sites[b];
+    t->order[a] = t->order[b];
+    t->sites[b] = site;
+    t->order[b] = idx;
+}
+
+/*
+    Quickselect, moves the site that sorts to `nth` there with no larger
+    one before and no smaller one after it. The partition is three way
+    since anchors have integer positions and often share a coordinate.
+*/
+static void selectSite(tree *t, size_t lo, size_t hi, size_t nth, bool vertical) {
+    while(hi - lo > 1) {
+        double pivot = coordinate(t->sites[lo + (hi - lo) / 2], vertical);
+        size_t less = lo, more = hi, idx = lo;
+
+        while(idx < more) {
+            double value = coordinate(t->sites[idx], vertical);
+
+            if(value < pivot) {
+                swapSites(t, less++, idx++);
+            } else if(value > pivot) {
+                swapSites(t, idx, --more);
+            } else {
+                idx++;
+            }
+        }
+
+        if(nth < less) {
+            hi = less;
+        } else if(nth >= more) {
+            lo = more;
+        } else {
+            return;
+        }
+    }
+}
+
+static void buildNode(tree *t, size_t lo, size_t hi) {
+    if(lo >= hi) return;
+
+    size_t mid = lo + (hi - lo) / 2;
+    box *b = &t->boxes[mid];
+
+    *b = (box){t->sites[lo].x, t->sites[lo].y, t->sites[lo].x, t->sites[lo].y};
+
+    for(size_t idx = lo + 1; idx < hi; idx++) {
+        vertex s = t->sites[idx];
+        if(s.x < b->min_x) b->min_x = s.x;
+        if(s.y < b->min_y) b->min_y = s.y;
+        if(s.x > b->max_x) b->max_x = s.x;
+        if(s.y > b->max_y) b->max_y = s.y;
+    }
+
+    selectSite(t, lo, hi, mid, splitsVertically(b));
+    buildNode(t, lo, mid);
+    buildNode(t, mid + 1, hi);
+}
+
+static int buildTree(tree *t, const anchor *anchors, size_t num_anchors) {
+    t->size = num_anchors;
+    t->order = malloc(num_anchors * sizeof(size_t));
+    t->sites = malloc(num_anchors * sizeof(vertex));
+    t->boxes = malloc(num_anchors * sizeof(box));
+
+    if(!t->order || !t->sites || !t->boxes) {
+        warn("Failed to allocate memory");
+        free(t->order);
+        free(t->sites);
+        free(t->boxes);
+        return 0;
+    }
+
+    for(size_t idx = 0; idx < num_anchors; idx++) {
+        t->order[idx] = idx;
+        t->sites[idx] = siteOf(&anchors[idx]);
+    }
+
+    buildNode(t, 0, num_anchors);
+    return 1;
+}
+
+static void freeTree(tree *t) {
+    free(t->order);
+    free(t->sites);
+    free(t->boxes);
+}
+
+static int pushVertex(polygon *poly, vertex v) {
+    if(poly->size == poly->capacity) {
+        size_t capacity = poly->capacity ? poly->capacity * 2 : 16;
+        vertex *points = realloc(poly->points, capacity * sizeof(vertex));
+        if(!points) return 0;
+
+        poly->points = points;
+        poly->capacity = capacity;
+    }
+
+    poly->points[poly->size++] = v;
+    return 1;
+}
+
+/*
+    Sutherland-Hodgman against the half plane of points closer to `site`
+    than to `other`, the result is written to `out`.
+*/
+static int clipPolygon(const polygon *in, polygon *out, vertex site, vertex other) {
+    vertex n = {other.x - site.x, other.y - site.y};
+    double c = (n.x * (site.x + other.x) + n.y * (site.y + other.y)) / 2;
+
+    out->size = 0;
+
+    for(size_t idx = 0; idx < in->size; idx++) {
+        vertex a = in->points[idx];
+        vertex b = in->points[(idx + 1) % in->size];
+        double da = n.x * a.x + n.y * a.y - c;
+        double db = n.x * b.x + n.y * b.y - c;
+
+        if(da <= 0 && pushVertex(out, a) == 0) return 0;
+
+        if((da < 0 && db > 0) || (da > 0 && db < 0)) {
+            double t = da / (da - db);
+            vertex v = {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+            if(pushVertex(out, v) == 0) return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+    A site can only cut the polygon if it is closer to one of its vertices
+    than `site` is, this checks whether any point of `b` could be. Ties
+    count so that sites at the position of `site` are still visited.
+*/
+static bool mayCut(const polygon *poly, vertex site, const box *b) {
+    for(size_t idx = 0; idx < poly->size; idx++) {
+        vertex v = poly->points[idx];
+        double dx = v.x < b->min_x ? b->min_x - v.x : v.x > b->max_x ? v.x - b->max_x : 0;
+        double dy = v.y < b->min_y ? b->min_y - v.y : v.y > b->max_y ? v.y - b->max_y : 0;
+        double sx = v.x - site.x;
+        double sy = v.y - site.y;
+
+        if(dx * dx + dy * dy <= sx * sx + sy * sy) return true;
+    }
+
+    return false;
+}
+
+/*
+    Clips the polygon of the site at `self` with the bisector of the site
+    at `other`. Of several anchors at the same position the first one gets
+    the cell, as in the rasterized diagram.
+*/
+static int clipSite(const tree *t, size_t self, size_t other, polygon *poly, polygon *scratch) {
+    vertex site = t->sites[self];
+    vertex v = t->sites[other];
+
+    if(other == self || poly->size == 0) return 1;
+
+    if(v.x == site.x && v.y == site.y) {
+        if(t->order[other] < t->order[self]) poly->size = 0;
+        return 1;
+    }
+
+    if(!mayCut(poly, site, &(box){v.x, v.y, v.x, v.y})) return 1;
+    if(clipPolygon(poly, scratch, site, v) == 0) return 0;
+
+    polygon tmp = *poly;
+    *poly = *scratch;
+    *scratch = tmp;
+    return 1;
+}
+
+/*
+    Clips with the sites in [lo, hi), the half closer to `self` first.
+    Sites within NEIGHBOR_WINDOW of `self` were clipped with already.
+*/
+static int clipNode(const tree *t, size_t lo, size_t hi, size_t self, polygon *poly, polygon *scratch) {
+    if(lo >= hi || poly->size == 0) return 1;
+
+    size_t mid = lo + (hi - lo) / 2;
+    vertex site = t->sites[self];
+
+    if(!mayCut(poly, site, &t->boxes[mid])) return 1;
+
+    if(hi - lo <= LEAF_SIZE) {
+        for(size_t other = lo; other < hi; other++) {
+            if(other + NEIGHBOR_WINDOW >= self && other <= self + NEIGHBOR_WINDOW) continue;
+            if(clipSite(t, self, other, poly, scratch) == 0) return 0;
+        }
+
+        return 1;
+    }
+
+    bool vertical = splitsVertically(&t->boxes[mid]);
+    bool left_first = coordinate(site, vertical) < coordinate(t->sites[mid], vertical);
+
+    if(clipNode(t, left_first ? lo : mid + 1, left_first ? mid : hi, self, poly, scratch) == 0) return 0;
+
+    if(mid + NEIGHBOR_WINDOW < self || mid > self + NEIGHBOR_WINDOW) {
+        if(clipSite(t, self, mid, poly, scratch) == 0) return 0;
+    }
+
+    return clipNode(t, left_first ? mid + 1 : lo, left_first ? hi : mid, self, poly, scratch);
+}
+
+/*
+    Starts from the whole canvas and clips it with the sites next to `self`
+    in the tree order, which are mostly its neighbors, so the polygon is
+    small before the tree is walked and most nodes are skipped right away.
+    `self` is a position in the tree order.
+*/
+static int computeCell(const tree *t, size_t self, point size, polygon *poly, polygon *scratch) {
+    size_t first = self > NEIGHBOR_WINDOW ? self - NEIGHBOR_WINDOW : 0;
+    size_t last = self + NEIGHBOR_WINDOW < t->size ? self + NEIGHBOR_WINDOW : t->size - 1;
+
+    poly->size = 0;
+    if(pushVertex(poly, (vertex){0, 0}) == 0 ||
+            pushVertex(poly, (vertex){size.x, 0}) == 0 ||
+            pushVertex(poly, (vertex){size.x, size.y}) == 0 ||
+            pushVertex(poly, (vertex){0, size.y}) == 0) {
+        return 0;
+    }
+
+    for(size_t other = first; other <= last; other++) {
+        if(clipSite(t, self, other, poly, scratch) == 0) return 0;
+    }
+
+    return clipNode(t, 0, t->size, self, poly, scratch);
+}
+
+/*
+    Vertices always lie on the canvas so they are never negative, printing
+    them as fixed point is a lot cheaper than going through printf.
+*/
+static void writeCoordinate(FILE *fp, double value) {
+    char buffer[32];
+    char *end = buffer + sizeof(buffer);
+    char *c = end;
+    unsigned long fixed = (unsigned long)(value * 100 + 0.5);
+
+    for(int digit = 0; digit < 2; digit++) {
+        *--c = '0' + fixed % 10;
+        fixed /= 10;
+    }
+
+    *--c = '.';
+
+    do {
+        *--c = '0' + fixed % 10;
+        fixed /= 10;
+    } while(fixed);
+
+    fwrite(c, 1, end - c, fp);
+}
+
+static void writeSVGCell(FILE *fp, const polygon *poly, const anchor *a) {
+    fprintf(fp, "<path fill=\"#%02x%02x%02x\" d=\"M", a->col.red, a->col.green, a->col.blue);
+
+    for(size_t idx = 0; idx < poly->size; idx++) {
+        if(idx > 0) fputs(" L", fp);
+        writeCoordinate(fp, poly->points[idx].x);
+        fputc(' ', fp);
+        writeCoordinate(fp, poly->points[idx].y);
+    }
+
+    fprintf(fp, "Z\"/>\n");
+}
+
+static void writeGeoJSONCell(FILE *fp, const polygon *poly, const anchor *a, size_t idx, bool first) {
+    fprintf(fp, "%s{\"type\":\"Feature\",\"properties\":{\"anchor\":%zu,\"x\":%ld,\"y\":%ld,\"fill\":\"#%02x%02x%02x\"},"
+            "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[",
+            first ? "" : ",\n", idx, a->pos.x, a->pos.y, a->col.red, a->col.green, a->col.blue);
+
+    for(size_t v = 0; v <= poly->size; v++) {
+        const vertex *p = &poly->points[v % poly->size];
+        fputs(v == 0 ? "[" : ",[", fp);
+        writeCoordinate(fp, p->x);
+        fputc(',', fp);
+        writeCoordinate(fp, p->y);
+        fputc(']', fp);
+    }
+
+    fprintf(fp, "]]}}");
+}
+
+/*
+    Computes the polygon of every cell clipped to the canvas and streams it
+    to the output file as soon as it is done, so memory use only depends on
+    the number of anchors and not on the size of the canvas. The cells are
+    written in tree order rather than in the order of the anchors.
+*/
+int generateVector(const char *filename, output_format format, const anchor *anchors, size_t num_anchors, point size) {
+    tree t;
+    polygon poly = {NULL, 0, 0};
+    polygon scratch = {NULL, 0, 0};
+    bool first = true;
+    int ret = 1;
+
+    if(num_anchors == 0 || buildTree(&t, anchors, num_anchors) == 0) {
+        return 0;
+    }
+
+    FILE *fp = fopen(filename, "w");
+    if(!fp) {
+        warn("Failed to open %s", filename);
+        freeTree(&t);
+        return 0;
+    }
+
+    setvbuf(fp, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+
+    if(format == FORMAT_SVG) {
+        fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%ld\" height=\"%ld\" viewBox=\"0 0 %ld %ld\">\n",
+                size.x, size.y, size.x, size.y);
+    } else {
+        fprintf(fp, "{\"type\":\"FeatureCollection\",\"features\":[\n");
+    }
+
+    for(size_t o = 0; o < num_anchors; o++) {
+        size_t idx = t.order[o];
+
+        if(computeCell(&t, o, size, &poly, &scratch) == 0) {
+            warn("Failed to allocate memory");
+            ret = 0;
+            break;
+        }
+
+        if(poly.size < 3) continue;
+
+        if(format == FORMAT_SVG) {
+            writeSVGCell(fp, &poly, &anchors[idx]);
+        } else {
+            writeGeoJSONCell(fp, &poly, &anchors[idx], idx, first);
+        }
+
+        first = false;
+    }
+
+    fprintf(fp, format == FORMAT_SVG ? "</svg>\n" : "\n]}\n");
+
+    if(fclose(fp) == EOF) {
+        warn("Failed to write %s", filename);
+        ret = 0;
+    }
+
+    free(poly.points);
+    free(scratch.points);
+    freeTree(&t);
+    return ret;
+}
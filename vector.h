@@ -0,0 +1,10 @@
+#ifndef VORONOI_VECTOR_H
+#define VORONOI_VECTOR_H
+
+#include <stddef.h>
+#include "./canvas.h"
+#include "./output.h"
+
+int generateVector(const char *, output_format, const anchor *, size_t, point);
+
+#endif
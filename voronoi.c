@@ -8,46 +8,205 @@
 
 #include "./canvas.h"
 #include "./argument.h"
+#include "./output.h"
+#include "./cell.h"
+#include "./vector.h"
+#include "./pool.h"
+#include "./cache.h"
+#include "./shard.h"
 
 /*
     TODO:
-    + verbose argument -v, --versbose
     + help message
-    + create threads only once instead of per frame
     + RLE on color map to reduce memory
     + print frame times
     + create intermediate images in /tmp
 */
 
+static void renderRaster(Params *options, shard_workers *shards) {
+    bool mapped = isMappedFormat(options->format);
+    size_t area = options->size.x * options->size.y * sizeof(color);
+    color *color_map = NULL;
+    mapped_output out;
+    framebuffer fb;
+
+    if(mapped) {
+        if(mapOutput(options->filename, options->format, options->size, &out) == 0) {
+            errx(1, "Exiting ...");
+        }
+
+        fb = out.fb;
+    } else {
+        color_map = allocatePixels(area, options->hugepages, &area);
+
+        if(!color_map) {
+            err(1, "mmap()");
+        }
+
+        fb = (framebuffer){
+            .data = (uint8_t*)color_map,
+            .size = options->size,
+            .stride = options->size.x * sizeof(color),
+            .format = PIXEL_RGB
+        };
+    }
+
+    if(options->frames == 1) {
+        cell_stats stats = { .cells = NULL, .adjacency = true, .edges = NULL };
+
+        if(options->cell_stats_file) {
+            stats.cells = calloc(options->anchors_size, sizeof(cell_accum));
+            if(!stats.cells) {
+                err(1, "Failed to allocate %zu bytes", options->anchors_size * sizeof(cell_accum));
+            }
+        }
+
+        if(shards->size > 0) {
+            if(generateSharded(shards, &fb, options->anchors, options->anchors_size, &options->render) == 0) {
+                errx(1, "Exiting ...");
+            }
+        } else if(accumulateCells(&fb, fb.size, options->anchors, options->anchors_size, stats.cells ? &stats : NULL, &options->render) == 0) {
+            errx(1, "Exiting ...");
+        }
+
+        if(stats.cells && writeCellStats(options->cell_stats_file, options->anchors, options->anchors_size, &stats) == 0) {
+            errx(1, "Exiting ...");
+        }
+
+        free(stats.cells);
+        free(stats.edges);
+
+        if(!mapped && generatePNG(options->filename, color_map, options->size) == 0) {
+            errx(1, "Exiting ...");
+        }
+    } else {
+        if(generateGIF(options->filename, options->anchors, options->anchors_size, color_map, options->size, options->frames, 3, options->keep, &options->render) == 0) {
+            errx(1, "Exiting ...");
+        }
+    }
+
+    if(mapped && unmapOutput(&out) == 0) {
+        errx(1, "Exiting ...");
+    }
+
+    if(color_map) munmap(color_map, area);
+}
+
+/*
+    Everything the output depends on, after the anchors and palette have
+    been resolved. The seed only matters past that point when the anchors
+    move between frames. Threads, pinning and huge pages do not change the
+    output and are left out.
+*/
+static cache_key paramsKey(const Params *options) {
+    cache_key key = {0};
+    const render_options *render = &options->render;
+
+    keyNumber(&key, options->format);
+    keyNumber(&key, options->size.x);
+    keyNumber(&key, options->size.y);
+    keyNumber(&key, options->frames);
+    keyNumber(&key, options->frames > 1 ? options->seed : 0);
+    keyNumber(&key, options->relax);
+    keyNumber(&key, options->relax > 0 ? options->relax_threshold : 0);
+    keyNumber(&key, render->metric);
+    keyNumber(&key, render->antialias > 1 ? render->antialias : 1);
+    keyNumber(&key, render->antialias > 1 ? render->pattern : 0);
+
+    keyNumber(&key, options->colors_size);
+    for(size_t idx = 0; idx < options->colors_size; idx++) {
+        const color *col = &options->colors[idx];
+        keyBytes(&key, (uint8_t[]){col->red, col->green, col->blue}, 3);
+    }
+
+    keyNumber(&key, options->anchors_size);
+    for(size_t idx = 0; idx < options->anchors_size; idx++) {
+        const anchor *anc = &options->anchors[idx];
+        keyNumber(&key, anc->pos.x);
+        keyNumber(&key, anc->pos.y);
+        keyNumber(&key, anc->weight);
+        keyBytes(&key, (uint8_t[]){anc->col.red, anc->col.green, anc->col.blue}, 3);
+    }
+
+    return key;
+}
+
+static void printCounters(const char *state, const cache_counters *counters) {
+    fprintf(stderr, "cache %s: %lu hits, %lu misses, %lu evictions\n",
+            state, counters->hits, counters->misses, counters->evictions);
+}
+
 int main(int argc, char **argv) {
 
     Params options = NEW_PARAMS();
     options = parseArguments(argc, argv);
 
-    long area = options.size.x * options.size.y * sizeof(color);
+    if(options.serve) {
+        if(serveWorkers(options.serve, &options.render) == 0) {
+            errx(1, "Exiting ...");
+        }
+
+        return 0;
+    }
+
+    cache_key key = {0};
+    cache_counters counters;
 
-    color *color_map = mmap(NULL, area, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(options.cache_dir) {
+        key = paramsKey(&options);
 
-    if(color_map == MAP_FAILED) {
-        err(1, "mmap()");
+        if(cacheFetch(options.cache_dir, &key, options.filename, &counters)) {
+            if(options.render.verbose) printCounters("hit", &counters);
+
+            freeKey(&key);
+            free(options.worker_addrs);
+            free(options.anchors);
+            free(options.colors);
+            return 0;
+        }
     }
 
-    if(options.frames == 1) {
-        if(generateVoronoi(color_map, options.size, options.anchors, options.anchors_size) == 0) {
+    /* Forked before the pool starts so the workers do not inherit its threads */
+    shard_workers shards = { .size = 0 };
+    if(options.workers > 0 || options.worker_addrs_size > 0) {
+        if(startWorkers(&shards, options.workers, options.worker_addrs, options.worker_addrs_size, &options.render) == 0) {
             errx(1, "Exiting ...");
         }
+    }
+
+    options.render.pool = poolCreate(options.render.threads, options.render.pin);
+    if(!options.render.pool) {
+        errx(1, "Failed to create threads");
+    }
 
-        if(generatePNG(options.filename, color_map, options.size) == 0) {
+    if(options.relax > 0) {
+        if(relaxAnchors(options.anchors, options.anchors_size, options.size, options.relax, options.relax_threshold, &options.render) == 0) {
             errx(1, "Exiting ...");
         }
-    } else {
-        if(generateGIF(options.filename, options.anchors, options.anchors_size, color_map, options.size, options.frames, 3, options.keep) == 0) {
+    }
+
+    if(isVectorFormat(options.format)) {
+        if(generateVector(options.filename, options.format, options.anchors, options.anchors_size, options.size) == 0) {
             errx(1, "Exiting ...");
         }
+    } else {
+        renderRaster(&options, &shards);
+    }
+
+    if(options.cache_dir) {
+        if(cacheStore(options.cache_dir, &key, options.filename, options.cache_limit, &counters) == 0) {
+            warnx("Failed to store %s in the cache", options.filename);
+        } else if(options.render.verbose) {
+            printCounters("miss", &counters);
+        }
+
+        freeKey(&key);
     }
 
+    stopWorkers(&shards);
+    poolDestroy(options.render.pool);
+    free(options.worker_addrs);
     if(options.anchors) free(options.anchors);
     if(options.colors) free(options.colors);
-    munmap(color_map, area);
     return 0;
 }